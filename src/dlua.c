@@ -375,7 +375,8 @@ static bool reload_surface(void* data, const void* arg)
 	if (!s->filename || !files_are_same(s->filename, filename))
 		return false;
 
-	if (display_load_surface(s->filename, &new_surface))
+	// a surface packed in an atlas is reloaded in its own texture
+	if (display_load_surface(s->filename, &new_surface, false))
 		return false;
 
 	SWAP(s->w, new_surface->w);
@@ -389,7 +390,18 @@ static bool reload_surface(void* data, const void* arg)
 	SWAP(s->fbo, new_surface->fbo);
 	SWAP(s->filter, new_surface->filter);
 	SWAP(s->pixels, new_surface->pixels);
-	SWAP(s->pixels_valid, new_surface->pixels_valid);
+	SWAP(s->stale_tiles, new_surface->stale_tiles);
+	SWAP(s->tile_shift, new_surface->tile_shift);
+	SWAP(s->dirty_tiles, new_surface->dirty_tiles);
+	SWAP(s->format, new_surface->format);
+	SWAP(s->locked, new_surface->locked);
+	SWAP(s->page, new_surface->page);
+	SWAP(s->page_x, new_surface->page_x);
+	SWAP(s->page_y, new_surface->page_y);
+	SWAP(s->grid, new_surface->grid);
+	SWAP(s->grid_columns, new_surface->grid_columns);
+	SWAP(s->grid_rows, new_surface->grid_rows);
+	SWAP(s->grid_cell_size, new_surface->grid_cell_size);
 	display_free_surface(new_surface);
 
 	display_set_filter(s, new_surface->filter);
@@ -32,6 +32,8 @@
 #ifdef BUILD_GRAPHICS
 #include "event/event.h"
 #include "graphics/display.h"
+#include "graphics/loader.h"
+#include "graphics/postfx.h"
 #endif
 #include "macro.h"
 #include "util.h"
@@ -77,7 +79,7 @@ static long unsigned get_now()
 static void engine_reload_queue(void);
 #endif
 
-int engine_init(const char* filename, unsigned int target_fps)
+int engine_init(const char* filename, unsigned int target_fps, _unused_ bool headless)
 {
 	engine.target_ms_per_frame = 1000 / target_fps;
 	engine.run = true;
@@ -97,7 +99,7 @@ int engine_init(const char* filename, unsigned int target_fps)
 		return r;
 	}
 
-	r = display_init();
+	r = display_init(headless);
 	if (r < 0) {
 		return r;
 	}
@@ -113,12 +115,17 @@ int engine_init(const char* filename, unsigned int target_fps)
 
 void engine_free(void)
 {
+#ifdef BUILD_GRAPHICS
+	// pending loads hold callbacks in the lua state
+	loader_free();
+#endif
 	dlua_free();
 #ifdef BUILD_AUDIO
 	audio_free();
 #endif
 #ifdef BUILD_GRAPHICS
 	event_destroy();
+	postfx_free();
 	display_free();
 	SDL_Quit();
 #endif
@@ -201,6 +208,10 @@ void engine_update(void)
 	audio_update(dt);
 #endif
 
+#ifdef BUILD_GRAPHICS
+	loader_update();
+#endif
+
 	if (engine.update_activated)
 		dlua_call_update(dt);
 
@@ -209,6 +220,7 @@ void engine_update(void)
 
 #ifdef BUILD_GRAPHICS
 	display_flip();
+	postfx_next_frame();
 #endif
 }
 
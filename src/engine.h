@@ -18,7 +18,7 @@
 
 #include <stdbool.h>
 
-int engine_init(const char *filename, unsigned int target_fps);
+int engine_init(const char *filename, unsigned int target_fps, bool headless);
 void engine_free(void);
 void engine_load(void);
 void engine_loop(void);
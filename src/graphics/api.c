@@ -24,6 +24,10 @@
 #include "camera_bind.h"
 #include "shader_bind.h"
 #include "buffer_bind.h"
+#include "float_array_bind.h"
+#include "pixel_array_bind.h"
+#include "tilemap_bind.h"
+#include "postfx_bind.h"
 #include "api.h"
 #include "util.h"
 
@@ -37,6 +41,8 @@ BEGIN_MODULE(graphics)
 
 	/* DISPLAY SURFACE */
 	DECLARE_FUNCTION(load_surface)
+	DECLARE_FUNCTION(load_surface_async)
+	DECLARE_FUNCTION(set_texture_cache)
 	DECLARE_FUNCTION(new_surface)
 
 	/* DISPLAY DRAWERS */
@@ -45,24 +51,66 @@ BEGIN_MODULE(graphics)
 	DECLARE_FUNCTION(draw_point_tex)
 	DECLARE_FUNCTION(draw_line)
 	DECLARE_FUNCTION(draw_triangle)
+	DECLARE_FUNCTION(draw_rect)
+	DECLARE_FUNCTION(draw_rect_rotated)
+	DECLARE_FUNCTION(draw_circle)
+	DECLARE_FUNCTION(draw_polygon)
+	DECLARE_FUNCTION(draw_polyline)
+	DECLARE_FUNCTION(draw_square)
 	DECLARE_FUNCTION(draw_surface)
 	DECLARE_FUNCTION(draw_quad)
+	DECLARE_FUNCTION(draw_sprite)
+	DECLARE_FUNCTION(draw_sprite_simple)
+	DECLARE_FUNCTION(draw_sprite_rotated)
+	DECLARE_FUNCTION(draw_sprite_resized)
+	DECLARE_FUNCTION(draw_sprites)
 
 	/* DISPLAY SETTERS */
 	DECLARE_FUNCTION(set_color)
 	DECLARE_FUNCTION(set_alpha)
 	DECLARE_FUNCTION(set_blend_mode)
+	DECLARE_FUNCTION(set_deferred)
+	DECLARE_FUNCTION(flush)
+	DECLARE_FUNCTION(set_direct_rendering)
+	DECLARE_FUNCTION(set_culling)
+	DECLARE_FUNCTION(set_cpu_camera)
 
 	BEGIN_CLASS(surface)
 		ADD_METHOD(surface, set_filter)
 		ADD_METHOD(surface, draw_on)
 		ADD_METHOD(surface, draw_from)
 		ADD_METHOD(surface, get_pixel)
+		ADD_METHOD(surface, get_pixels)
+		ADD_METHOD(surface, lock)
+		ADD_METHOD(surface, unlock)
 		ADD_GC(free_surface)
 	REGISTER_CLASS_WITH_INDEX(surface, "Surface")
 
+	DECLARE_FUNCTION(new_float_array)
+	BEGIN_CLASS(float_array)
+		PUSH_FUNC("__len", float_array_len)
+	REGISTER_CLASS_WITH_INDEX_AND_NEWINDEX(float_array, "FloatArray")
+
+	BEGIN_CLASS(pixel_array)
+		ADD_METHOD(pixel_array, get)
+		ADD_METHOD(pixel_array, set)
+		ADD_METHOD(pixel_array, fill)
+		ADD_METHOD(pixel_array, blit)
+		PUSH_FUNC("__len", pixel_array_len)
+	REGISTER_CLASS_WITH_INDEX_AND_NEWINDEX(pixel_array, "PixelArray")
+
+	DECLARE_FUNCTION(new_tilemap)
+	BEGIN_CLASS(tilemap)
+		ADD_METHOD(tilemap, get)
+		ADD_METHOD(tilemap, set)
+		ADD_METHOD(tilemap, fill)
+		ADD_METHOD(tilemap, draw)
+		ADD_GC(free_tilemap)
+	REGISTER_CLASS_WITH_INDEX(tilemap, "Tilemap")
+
 	DECLARE_FUNCTION(new_buffer)
 	DECLARE_FUNCTION(use_default_buffer)
+	DECLARE_FUNCTION(get_render_stats)
 	BEGIN_CLASS(buffer)
 	    ADD_METHOD(buffer, use)
 	    ADD_METHOD(buffer, draw)
@@ -76,9 +124,12 @@ BEGIN_MODULE(graphics)
 	BEGIN_CLASS(shader)
 	    ADD_METHOD(shader, use)
 	    ADD_METHOD(shader, feed)
+	    ADD_METHOD(shader, feed_many)
 	    ADD_GC(free_shader)
 	REGISTER_CLASS(shader, "Shader")
 
+	DECLARE_FUNCTION(apply_postfx)
+
 	{
 		// make sure we don't free the screen until the next resize
 		push_surface(L, display_get_screen());
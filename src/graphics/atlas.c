@@ -0,0 +1,293 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "atlas.h"
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+#include "opengl_util.h"
+
+log_category("atlas");
+
+typedef struct SkylineNode SkylineNode;
+typedef struct AtlasPage AtlasPage;
+
+// top of the used space, from x to x + w
+struct SkylineNode {
+	unsigned int x;
+	unsigned int y;
+	unsigned int w;
+};
+
+struct AtlasPage {
+	Surface *surface;
+
+	SkylineNode *nodes;
+	size_t nodes_size;
+	unsigned int num_nodes;
+
+	// number of surfaces packed in this page
+	int ref;
+};
+
+static AtlasPage *pages;
+static size_t pages_size;
+static unsigned int num_pages;
+
+/**
+ * Returns the height at which a rectangle of size (w, h) could be placed
+ * starting at the node index, or -1 if it does not fit.
+ */
+static int atlas_page_fit(const AtlasPage *page, unsigned int index, unsigned int w, unsigned int h)
+{
+	unsigned int remaining = w;
+	unsigned int y = 0;
+
+	if (page->nodes[index].x + w > ATLAS_PAGE_SIZE)
+		return -1;
+
+	// the last node always reaches the right side of the page
+	for (unsigned int i = index; remaining > 0; i++) {
+		assert(i < page->num_nodes);
+		y = MAX(y, page->nodes[i].y);
+		if (y + h > ATLAS_PAGE_SIZE)
+			return -1;
+		remaining -= MIN(remaining, page->nodes[i].w);
+	}
+
+	return y;
+}
+
+/**
+ * Finds the lowest position (bottom-left rule) for a rectangle of size (w, h).
+ */
+static bool atlas_page_find(const AtlasPage *page, unsigned int w, unsigned int h,
+                            unsigned int *index, unsigned int *x, unsigned int *y)
+{
+	unsigned int best_bottom = ATLAS_PAGE_SIZE + 1;
+	unsigned int best_width = ATLAS_PAGE_SIZE + 1;
+
+	for (unsigned int i = 0; i < page->num_nodes; i++) {
+		int fit = atlas_page_fit(page, i, w, h);
+		if (fit < 0)
+			continue;
+
+		unsigned int bottom = fit + h;
+		if (bottom < best_bottom || (bottom == best_bottom && page->nodes[i].w < best_width)) {
+			best_bottom = bottom;
+			best_width = page->nodes[i].w;
+			*index = i;
+			*x = page->nodes[i].x;
+			*y = fit;
+		}
+	}
+
+	return best_bottom <= ATLAS_PAGE_SIZE;
+}
+
+static void atlas_page_remove_node(AtlasPage *page, unsigned int index)
+{
+	memmove(&page->nodes[index], &page->nodes[index + 1],
+	        (page->num_nodes - index - 1) * sizeof(SkylineNode));
+	page->num_nodes--;
+}
+
+static void atlas_page_insert(AtlasPage *page, unsigned int index,
+                              unsigned int x, unsigned int y, unsigned int w)
+{
+	XREALLOC(page->nodes, page->nodes_size, page->num_nodes + 1);
+	memmove(&page->nodes[index + 1], &page->nodes[index],
+	        (page->num_nodes - index) * sizeof(SkylineNode));
+	page->nodes[index].x = x;
+	page->nodes[index].y = y;
+	page->nodes[index].w = w;
+	page->num_nodes++;
+
+	// shrink or remove the nodes now under the new one
+	while (index + 1 < page->num_nodes) {
+		SkylineNode *new_node = &page->nodes[index];
+		SkylineNode *node = &page->nodes[index + 1];
+		unsigned int end = new_node->x + new_node->w;
+
+		if (node->x >= end)
+			break;
+		if (node->x + node->w > end) {
+			node->w -= end - node->x;
+			node->x = end;
+			break;
+		}
+		atlas_page_remove_node(page, index + 1);
+	}
+
+	for (unsigned int i = 0; i + 1 < page->num_nodes;) {
+		if (page->nodes[i].y == page->nodes[i + 1].y) {
+			page->nodes[i].w += page->nodes[i + 1].w;
+			atlas_page_remove_node(page, i + 1);
+		} else {
+			i++;
+		}
+	}
+}
+
+static AtlasPage *atlas_new_page(Surface *current_from, Surface *current_on)
+{
+	AtlasPage *page;
+
+	XREALLOC(pages, pages_size, num_pages + 1);
+	page = &pages[num_pages++];
+	page->surface = surface_new(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE,
+	                            FORMAT_RGBA, NULL, current_from, current_on);
+	page->nodes = new(SkylineNode, 1);
+	page->nodes_size = 1;
+	page->num_nodes = 1;
+	page->nodes[0].x = 0;
+	page->nodes[0].y = 0;
+	page->nodes[0].w = ATLAS_PAGE_SIZE;
+	page->ref = 0;
+
+	log_debug("new page %u", num_pages);
+	return page;
+}
+
+/**
+ * Converts the image to RGBA and extrudes its border by ATLAS_PADDING pixels.
+ * Rows of 'pixels' are 'stride' pixels long.
+ */
+static unsigned char *atlas_pad_pixels(unsigned int w, unsigned int h, SurfaceFormat format, const unsigned char *pixels, unsigned int stride)
+{
+	unsigned int components = surface_format_components(format);
+	unsigned int pw = w + 2 * ATLAS_PADDING;
+	unsigned int ph = h + 2 * ATLAS_PADDING;
+	unsigned char *padded = new(unsigned char, pw * ph * 4);
+
+	for (unsigned int py = 0; py < ph; py++) {
+		unsigned int sy = py < ATLAS_PADDING ? 0 : MIN(py - ATLAS_PADDING, h - 1);
+		for (unsigned int px = 0; px < pw; px++) {
+			unsigned int sx = px < ATLAS_PADDING ? 0 : MIN(px - ATLAS_PADDING, w - 1);
+			const unsigned char *src = pixels + (sx + sy * stride) * components;
+			unsigned char *dst = padded + (px + py * pw) * 4;
+
+			switch (components) {
+				case 1:
+					dst[0] = dst[1] = dst[2] = src[0];
+					dst[3] = 255;
+					break;
+				case 2:
+					dst[0] = dst[1] = dst[2] = src[0];
+					dst[3] = src[1];
+					break;
+				case 3:
+					memcpy(dst, src, 3);
+					dst[3] = 255;
+					break;
+				default:
+					memcpy(dst, src, 4);
+					break;
+			}
+		}
+	}
+
+	return padded;
+}
+
+/**
+ * Packs the image in the first page with enough space, and returns
+ * a surface which shares the texture of the page.
+ */
+Surface *atlas_add(unsigned int w, unsigned int h, SurfaceFormat format, const unsigned char *pixels, unsigned int stride,
+                   Surface *current_from, Surface *current_on)
+{
+	unsigned int pw = w + 2 * ATLAS_PADDING;
+	unsigned int ph = h + 2 * ATLAS_PADDING;
+	AtlasPage *page = NULL;
+	unsigned int index, x, y;
+	unsigned char *padded;
+	Surface *s;
+
+	assert(pixels);
+	assert(stride >= w);
+	assert(w > 0 && pw <= ATLAS_PAGE_SIZE);
+	assert(h > 0 && ph <= ATLAS_PAGE_SIZE);
+
+	for (unsigned int i = 0; i < num_pages; i++) {
+		if (atlas_page_find(&pages[i], pw, ph, &index, &x, &y)) {
+			page = &pages[i];
+			break;
+		}
+	}
+	if (!page) {
+		bool found;
+
+		page = atlas_new_page(current_from, current_on);
+		found = atlas_page_find(page, pw, ph, &index, &x, &y);
+		assert(found);
+	}
+	atlas_page_insert(page, index, x, y + ph, pw);
+
+	padded = atlas_pad_pixels(w, h, format, pixels, stride);
+	gl_bind_texture(page->surface->tex);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, pw, ph, GL_RGBA, GL_UNSIGNED_BYTE, padded);
+	gl_bind_texture(current_from ? current_from->tex : 0);
+	free(padded);
+	GLDEBUG();
+
+	page->surface->has_mipmap = false;
+	surface_mark_stale(page->surface, x, y, x + pw, y + ph);
+	page->ref++;
+
+	s = new0(Surface, 1);
+	s->w = w;
+	s->h = h;
+	s->texw = page->surface->texw;
+	s->texh = page->surface->texh;
+	s->filter = page->surface->filter;
+	s->tex = page->surface->tex;
+	s->page = page->surface;
+	s->page_x = x + ATLAS_PADDING;
+	s->page_y = y + ATLAS_PADDING;
+
+	return s;
+}
+
+/**
+ * Called when a surface packed in the page is freed,
+ * the page is freed with its last surface.
+ */
+void atlas_release(Surface *page_surface)
+{
+	assert(page_surface);
+
+	for (unsigned int i = 0; i < num_pages; i++) {
+		AtlasPage *page = &pages[i];
+		if (page->surface != page_surface)
+			continue;
+
+		assert(page->ref > 0);
+		page->ref--;
+		if (page->ref == 0) {
+			surface_free(page->surface);
+			free(page->nodes);
+			memmove(&pages[i], &pages[i + 1], (num_pages - i - 1) * sizeof(AtlasPage));
+			num_pages--;
+		}
+		return;
+	}
+
+	assert(false);
+}
@@ -0,0 +1,30 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "surface.h"
+
+#define ATLAS_PAGE_SIZE 2048
+// images bigger than this get their own texture
+#define ATLAS_MAX_SURFACE_SIZE 512
+// each image is surrounded by a copy of its border, so filtering does not
+// sample its neighbours
+#define ATLAS_PADDING 1
+
+Surface *atlas_add(unsigned int w, unsigned int h, SurfaceFormat format, const unsigned char *pixels, unsigned int stride,
+                   Surface *current_from, Surface *current_on);
+void atlas_release(Surface *page);
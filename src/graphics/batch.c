@@ -0,0 +1,193 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "batch.h"
+#include "util.h"
+
+BatchList *batch_list_new(void)
+{
+	BatchList *list = new0(BatchList, 1);
+	list->blend = BLEND_DEFAULT;
+
+	return list;
+}
+
+void batch_list_free(BatchList *list)
+{
+	if (!list)
+		return;
+
+	free(list->vertices);
+	free(list->batches);
+	free(list->groups);
+	free(list);
+}
+
+void batch_list_clear(BatchList *list)
+{
+	assert(list);
+
+	list->num_vertices = 0;
+	list->num_batches = 0;
+	list->num_groups = 0;
+}
+
+static bool batch_same_state(const Batch *a, const Batch *b)
+{
+	return a->draw_on == b->draw_on
+	       && a->draw_from == b->draw_from
+	       && a->shader == b->shader
+	       && a->has_texture == b->has_texture
+	       && a->blend == b->blend
+	       && !memcmp(&a->camera, &b->camera, sizeof(Camera));
+}
+
+/**
+ * Tells if the batch cannot be moved before the group
+ * (the group may be drawn on what the batch reads, or they write the same pixels)
+ */
+static bool batch_depends_on(const BatchList *list, const Batch *batch, const BatchGroup *group)
+{
+	const Batch *first = &list->batches[group->first];
+
+	if (batch->draw_from && batch->draw_from == first->draw_on)
+		return true;
+	if (first->draw_from && first->draw_from == batch->draw_on)
+		return true;
+	if (batch->draw_on != first->draw_on)
+		return false;
+	return batch->xmin < group->xmax && group->xmin < batch->xmax
+	       && batch->ymin < group->ymax && group->ymin < batch->ymax;
+}
+
+static void batch_compute_bounds(const BatchList *list, Batch *batch, const Vertex *vertices)
+{
+	float xmin, ymin, xmax, ymax;
+	float w = batch->draw_on->texw;
+	float h = batch->draw_on->texh;
+	float corners[4][2];
+
+	if (batch->shader != list->default_shader) {
+		// the vertex shader can move the vertices, the batch may cover the whole surface
+		batch->xmin = batch->ymin = -1;
+		batch->xmax = batch->ymax = 1;
+		return;
+	}
+
+	xmin = xmax = vertices[0].x;
+	ymin = ymax = vertices[0].y;
+	for (unsigned int i = 1; i < batch->num_vertices; i++) {
+		xmin = MIN(xmin, vertices[i].x);
+		xmax = MAX(xmax, vertices[i].x);
+		ymin = MIN(ymin, vertices[i].y);
+		ymax = MAX(ymax, vertices[i].y);
+	}
+
+	// the camera may rotate the box, so project each corner
+	camera_project(&batch->camera, w, h, xmin, ymin, &corners[0][0], &corners[0][1]);
+	camera_project(&batch->camera, w, h, xmax, ymin, &corners[1][0], &corners[1][1]);
+	camera_project(&batch->camera, w, h, xmax, ymax, &corners[2][0], &corners[2][1]);
+	camera_project(&batch->camera, w, h, xmin, ymax, &corners[3][0], &corners[3][1]);
+
+	batch->xmin = batch->xmax = corners[0][0];
+	batch->ymin = batch->ymax = corners[0][1];
+	for (int i = 1; i < 4; i++) {
+		batch->xmin = MIN(batch->xmin, corners[i][0]);
+		batch->xmax = MAX(batch->xmax, corners[i][0]);
+		batch->ymin = MIN(batch->ymin, corners[i][1]);
+		batch->ymax = MAX(batch->ymax, corners[i][1]);
+	}
+}
+
+static void batch_list_add_to_group(BatchList *list, int index, BatchGroup *group)
+{
+	const Batch *batch = &list->batches[index];
+
+	list->batches[group->last].next = index;
+	group->last = index;
+	group->xmin = MIN(group->xmin, batch->xmin);
+	group->xmax = MAX(group->xmax, batch->xmax);
+	group->ymin = MIN(group->ymin, batch->ymin);
+	group->ymax = MAX(group->ymax, batch->ymax);
+}
+
+static void batch_list_new_group(BatchList *list, int index)
+{
+	const Batch *batch = &list->batches[index];
+	BatchGroup *group;
+
+	XREALLOC(list->groups, list->groups_size, list->num_groups + 1);
+	group = &list->groups[list->num_groups++];
+	group->first = group->last = index;
+	group->xmin = batch->xmin;
+	group->xmax = batch->xmax;
+	group->ymin = batch->ymin;
+	group->ymax = batch->ymax;
+}
+
+/**
+ * Copies the vertices of the buffer and the state they should be drawn with.
+ * The batch joins the latest group with the same state, unless a group
+ * recorded in between depends on it.
+ */
+void batch_list_record(BatchList *list, const Buffer *b)
+{
+	Batch *batch;
+	int index;
+
+	assert(list);
+	assert(b);
+	assert(b->draw_on);
+	assert(b->camera);
+
+	if (buffer_is_empty(b))
+		return;
+
+	XREALLOC(list->batches, list->batches_size, list->num_batches + 1);
+	XREALLOC(list->vertices, list->vertices_size, list->num_vertices + b->current_vertex);
+
+	index = list->num_batches++;
+	batch = &list->batches[index];
+	batch->draw_on = b->draw_on;
+	batch->draw_from = b->has_texture ? b->draw_from : NULL;
+	batch->shader = b->shader;
+	batch->has_texture = b->has_texture;
+	batch->blend = list->blend;
+	batch->camera = *b->camera;
+	batch->first_vertex = list->num_vertices;
+	batch->num_vertices = b->current_vertex;
+	batch->next = -1;
+
+	memcpy(list->vertices + list->num_vertices, b->vertices, b->current_vertex * sizeof(Vertex));
+	list->num_vertices += b->current_vertex;
+
+	batch_compute_bounds(list, batch, list->vertices + batch->first_vertex);
+
+	for (int i = list->num_groups - 1; i >= 0; i--) {
+		BatchGroup *group = &list->groups[i];
+
+		if (batch_same_state(batch, &list->batches[group->first])) {
+			batch_list_add_to_group(list, index, group);
+			return;
+		}
+		if (batch_depends_on(list, batch, group))
+			break;
+	}
+	batch_list_new_group(list, index);
+}
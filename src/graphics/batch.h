@@ -0,0 +1,102 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef struct Batch Batch;
+typedef struct BatchGroup BatchGroup;
+typedef struct BatchList BatchList;
+
+#include "buffer.h"
+#include "camera.h"
+#include "display.h"
+#include "shader.h"
+#include "surface.h"
+
+// after this number of recorded batches, the list should be replayed
+#define BATCH_LIST_MAX_BATCHES 4096
+
+// vertices flushed by the default buffer while the display is in deferred mode
+// they are drawn later with the state recorded here
+struct Batch {
+	Surface *draw_on;
+	Surface *draw_from; // NULL if !has_texture
+	Shader *shader;
+	bool has_texture;
+	BlendMode blend;
+	Camera camera;
+
+	unsigned int first_vertex; // index in BatchList.vertices
+	unsigned int num_vertices;
+
+	// bounding box in normalized device coordinates of draw_on
+	float xmin, ymin, xmax, ymax;
+
+	int next; // next batch of the same group, -1 if last
+};
+
+// batches sharing the same state, drawn with a single flush
+// groups are replayed in order, a batch can only join a group if it does not
+// overlap (or read from, or write to) any group recorded after it
+struct BatchGroup {
+	int first;
+	int last;
+
+	float xmin, ymin, xmax, ymax;
+};
+
+struct BatchList {
+	Vertex *vertices;
+	size_t vertices_size;
+	unsigned int num_vertices;
+
+	Batch *batches;
+	size_t batches_size;
+	unsigned int num_batches;
+
+	BatchGroup *groups;
+	size_t groups_size;
+	unsigned int num_groups;
+
+	// blend mode of the display, recorded with the batches
+	BlendMode blend;
+	// batches drawn with another shader may put their vertices anywhere on draw_on
+	const Shader *default_shader;
+};
+
+BatchList *batch_list_new(void);
+void batch_list_free(BatchList *list);
+
+void batch_list_record(BatchList *list, const Buffer *b);
+void batch_list_clear(BatchList *list);
+
+static inline bool batch_list_is_empty(const BatchList *list)
+{
+	assert(list);
+
+	return list->num_batches == 0;
+}
+
+static inline bool batch_list_is_full(const BatchList *list)
+{
+	assert(list);
+
+	return list->num_batches >= BATCH_LIST_MAX_BATCHES;
+}
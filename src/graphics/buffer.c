@@ -15,8 +15,11 @@
  * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <assert.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "buffer.h"
+#include "batch.h"
 #include "display.h"
 #include "shader.h"
 #include "util.h"
@@ -25,31 +28,105 @@
 
 log_category("buffer");
 
+// stats of the frame being drawn, and of the last complete frame
+static BufferStats stats;
+static BufferStats last_stats;
+
+// static index buffer shared by all buffers, describes quads (0 1 2, 0 2 3)
+static GLuint quad_indices;
+// vertex attributes currently set, they do not change when the same part of a vbo is drawn again
+static GLuint attributes_vbo;
+static size_t attributes_offset;
+static bool attributes_texture;
+
+void buffer_create_quad_indices(void)
+{
+	size_t num_quads = BUFFER_INDEXED_VERTICES / 4;
+	GLushort *indices = new(GLushort, num_quads * 6);
+
+	for (size_t i = 0; i < num_quads; i++) {
+		GLushort first = i * 4;
+		indices[i * 6 + 0] = first;
+		indices[i * 6 + 1] = first + 1;
+		indices[i * 6 + 2] = first + 2;
+		indices[i * 6 + 3] = first;
+		indices[i * 6 + 4] = first + 2;
+		indices[i * 6 + 5] = first + 3;
+	}
+
+	glGenBuffers(1, &quad_indices);
+	gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_indices);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_quads * 6 * sizeof(GLushort), indices, GL_STATIC_DRAW);
+	check_opengl_oom();
+
+	free(indices);
+}
+
+void buffer_free_quad_indices(void)
+{
+	gl_delete_buffer(quad_indices);
+	quad_indices = 0;
+}
+
 static void buffer_upload(Buffer *b, int method)
 {
 	size_t used;
 
 	assert(b);
 
-	used = b->current_color;
+	used = b->current_vertex;
 	if (used == 0 || b->uploaded) {
 		return;
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, b->buffers[0]);
-	glBufferData(GL_ARRAY_BUFFER, used * 2 * sizeof(GLfloat), b->positions, method);
+	gl_bind_buffer(GL_ARRAY_BUFFER, b->vbo);
+	glBufferData(GL_ARRAY_BUFFER, used * sizeof(Vertex), b->vertices, method);
 	check_opengl_oom();
 
-	glBindBuffer(GL_ARRAY_BUFFER, b->buffers[1]);
-	glBufferData(GL_ARRAY_BUFFER, used * 4 * sizeof(GLubyte), b->colors, method);
+	stats.uploads++;
+	stats.bytes_uploaded += used * sizeof(Vertex);
+	b->uploaded = true;
+}
+
+static void buffer_orphan_stream(Buffer *b)
+{
+	assert(b);
+	assert(b->stream);
+
+	// the driver gives us new storage, the old one lives until the draws using it are done
+	glBufferData(GL_ARRAY_BUFFER, BUFFER_STREAM_SIZE * sizeof(Vertex), NULL, GL_STREAM_DRAW);
 	check_opengl_oom();
+	b->stream_offset = 0;
+}
 
-	if (b->has_texture) {
-		glBindBuffer(GL_ARRAY_BUFFER, b->buffers[2]);
-		glBufferData(GL_ARRAY_BUFFER, used * 2 * sizeof(GLfloat), b->tex_coords, method);
-		check_opengl_oom();
+/**
+ * Appends the vertices to the stream VBO and returns the offset (in vertices)
+ * where they have been written.
+ */
+static unsigned int buffer_upload_stream(Buffer *b)
+{
+	size_t used;
+	unsigned int offset;
+
+	assert(b);
+	assert(b->stream);
+
+	used = b->current_vertex;
+	assert(used <= BUFFER_STREAM_SIZE);
+
+	gl_bind_buffer(GL_ARRAY_BUFFER, b->vbo);
+	if (b->stream_offset + used > BUFFER_STREAM_SIZE) {
+		buffer_orphan_stream(b);
+		stats.orphans++;
 	}
-	b->uploaded = true;
+
+	offset = b->stream_offset;
+	glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(Vertex), used * sizeof(Vertex), b->vertices);
+	b->stream_offset += used;
+
+	stats.uploads++;
+	stats.bytes_uploaded += used * sizeof(Vertex);
+	return offset;
 }
 
 static void buffer_partial_free(Buffer *b)
@@ -57,32 +134,22 @@ static void buffer_partial_free(Buffer *b)
 	if (!b)
 		return;
 
-	free(b->positions);
-	free(b->colors);
-	free(b->tex_coords);
-	b->positions = NULL;
-	b->colors = NULL;
-	b->tex_coords = NULL;
+	free(b->vertices);
+	b->vertices = NULL;
 }
 
 static bool buffer_is_full(const Buffer *b)
 {
 	assert(b);
 
-	return b->current_position > b->size - 3;
+	return b->current_vertex + 4 > b->size;
 }
 
 static void buffer_resize(Buffer *b) {
-	size_t size_positions = b->size * 2;
-	size_t size_colors = b->size * 4;
-	size_t size_tex_coords = b->size * 2;
-
-	XREALLOC(b->positions, size_positions, size_positions + 2);
-	XREALLOC(b->colors, size_colors, size_colors + 4);
-	if (b->tex_coords) {
-		XREALLOC(b->tex_coords, size_tex_coords, size_tex_coords + 2);
-	}
-	b->size = size_colors / 4;
+	size_t size = b->size;
+
+	XREALLOC(b->vertices, size, size + 4);
+	b->size = size;
 	log_info("new size: %u", b->size);
 }
 
@@ -90,8 +157,7 @@ Buffer *buffer_new(bool user_buffer, unsigned int size)
 {
 	Buffer *b = new0(Buffer, 1);
 	b->size = size;
-	b->positions = new(GLfloat, size * 2);
-	b->colors = new(GLubyte, size * 4);
+	b->vertices = new(Vertex, size);
 	b->user_buffer = user_buffer;
 
 	return b;
@@ -101,11 +167,17 @@ void buffer_allocate(Buffer *b)
 {
 	assert(b);
 
-	glGenBuffers(3, b->buffers);
+	glGenBuffers(1, &b->vbo);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glEnableVertexAttribArray(ATTR_LOCATION_POSITION);
-	glEnableVertexAttribArray(ATTR_LOCATION_COLOR);
+	if (!b->user_buffer) {
+		assert(b->size <= BUFFER_STREAM_SIZE);
+		b->stream = true;
+		gl_bind_buffer(GL_ARRAY_BUFFER, b->vbo);
+		buffer_orphan_stream(b);
+	}
+
+	gl_vertex_attrib_array(ATTR_LOCATION_POSITION, true);
+	gl_vertex_attrib_array(ATTR_LOCATION_COLOR, true);
 }
 
 void buffer_free(Buffer *b)
@@ -113,7 +185,9 @@ void buffer_free(Buffer *b)
 	if (!b)
 		return;
 
-	glDeleteBuffers(3, b->buffers);
+	if (attributes_vbo == b->vbo)
+		attributes_vbo = 0;
+	gl_delete_buffer(b->vbo);
 	buffer_partial_free(b);
 	free(b);
 }
@@ -126,17 +200,17 @@ void buffer_check_not_full(Buffer *b)
 		if (b->user_buffer) {
 			buffer_resize(b);
 		} else {
-			buffer_flush(b);
+			buffer_flush(b, FLUSH_FULL);
 		}
 	}
 }
 
-void buffer_check_empty(Buffer *b)
+void buffer_check_empty(Buffer *b, FlushCause cause)
 {
 	assert(b);
 
-	if (b->current_color != 0) {
-		buffer_flush(b);
+	if (b->current_vertex != 0) {
+		buffer_flush(b, cause);
 	}
 }
 
@@ -145,12 +219,9 @@ void buffer_check_use_texture(Buffer *b)
 	assert(b);
 
 	if (!b->has_texture) {
-		buffer_flush(b);
+		buffer_flush(b, FLUSH_TEXTURE);
 		b->has_texture = true;
 	}
-	if (b->tex_coords == NULL) {
-		b->tex_coords = new(GLfloat, b->size * 2);
-	}
 }
 
 void buffer_check_not_use_texture(Buffer *b)
@@ -158,124 +229,133 @@ void buffer_check_not_use_texture(Buffer *b)
 	assert(b);
 
 	if (b->has_texture) {
-		buffer_flush(b);
+		buffer_flush(b, FLUSH_TEXTURE);
 		b->has_texture = false;
 	}
 }
 
-void buffer_push_vertex(Buffer *b, GLfloat x, GLfloat y)
+void buffer_flush(Buffer *b, FlushCause cause)
 {
-	size_t cur;
-
 	assert(b);
-	assert(b->current_position < b->size);
+	assert(cause < FLUSH_CAUSE_COUNT);
 
-	cur = b->current_position * 2;
-
-	b->positions[cur + 0] = x;
-	b->positions[cur + 1] = y;
-	b->current_position += 1;
-	b->uploaded = false;
-}
-
-void buffer_push_color(Buffer *buffer, GLubyte r, GLubyte g, GLubyte b, GLubyte a)
-{
-	size_t cur;
-
-	assert(buffer);
-	assert(buffer->current_color < buffer->size);
-
-	cur = buffer->current_color * 4;
+	if (!buffer_is_empty(b)) {
+		stats.flushes++;
+		stats.flushes_by_cause[cause]++;
+	}
 
-	buffer->colors[cur + 0] = r;
-	buffer->colors[cur + 1] = g;
-	buffer->colors[cur + 2] = b;
-	buffer->colors[cur + 3] = a;
-	buffer->current_color += 1;
-	buffer->uploaded = false;
+	if (b->batches) {
+		batch_list_record(b->batches, b);
+	} else {
+		buffer_draw(b, 0, 0);
+	}
+	buffer_reset(b);
 }
 
-void buffer_push_tex_coord(Buffer *b, GLfloat x, GLfloat y)
+void buffer_upload_and_free(Buffer *b)
 {
-	size_t cur;
-
 	assert(b);
-	assert(b->current_tex_coord < b->size);
-
-	cur = b->current_tex_coord * 2;
 
-	b->tex_coords[cur + 0] = x;
-	b->tex_coords[cur + 1] = y;
-	b->current_tex_coord += 1;
-	b->uploaded = false;
+	buffer_upload(b, GL_STATIC_DRAW);
+	buffer_partial_free(b);
 }
 
-void buffer_upload_and_free(Buffer *b)
+static void buffer_set_attributes(const Buffer *b, size_t offset)
 {
 	assert(b);
 
-	buffer_upload(b, GL_STATIC_DRAW);
-	buffer_partial_free(b);
+	if (b->vbo == attributes_vbo && offset == attributes_offset
+	    && (!b->has_texture || attributes_texture))
+		return;
+	attributes_vbo = b->vbo;
+	attributes_offset = offset;
+	attributes_texture = b->has_texture;
+
+	glVertexAttribPointer(ATTR_LOCATION_POSITION, 2, GL_FLOAT, GL_FALSE,
+	                      sizeof(Vertex), (const GLvoid *) (offset + offsetof(Vertex, x)));
+	glVertexAttribPointer(ATTR_LOCATION_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+	                      sizeof(Vertex), (const GLvoid *) (offset + offsetof(Vertex, r)));
+	if (b->has_texture) {
+		glVertexAttribPointer(ATTR_LOCATION_TEXCOORD, 2, GL_FLOAT, GL_FALSE,
+		                      sizeof(Vertex), (const GLvoid *) (offset + offsetof(Vertex, u)));
+	}
 }
 
 void buffer_draw(Buffer *b, float dx, float dy)
 {
 	size_t used;
+	size_t offset = 0;
 
 	assert(b);
 
-	used = b->current_color;
+	used = b->current_vertex;
 	if (used == 0) {
 		return;
 	}
 
 	Shader* shader = b->shader;
 
-	assert(b->current_color == b->current_position);
-	assert(!b->has_texture || b->current_color == b->current_tex_coord);
+	assert(used % 4 == 0);
 	assert(shader);
 	assert(b->camera);
 
-	GLint prog;
-	VarLocationIndex locationIndex;
-	if (b->has_texture) {
-		prog = shader->prog_tex;
-		locationIndex = VAR_LOCATION_TEX;
-	} else {
-		prog = shader->prog_color;
-		locationIndex = VAR_LOCATION_COLOR;
-	}
-	glUseProgram(prog);
+	VarLocationIndex locationIndex = b->has_texture ? VAR_LOCATION_TEX : VAR_LOCATION_COLOR;
+	GLuint prog = shader_use_program(shader, locationIndex);
+	if (!prog)
+		return;
+	gl_use_program(prog);
+	shader_upload_uniforms(shader, locationIndex);
 
-	if (!b->uploaded)
+	if (b->stream)
+		offset = buffer_upload_stream(b) * sizeof(Vertex);
+	else if (!b->uploaded)
 		buffer_upload(b, GL_DYNAMIC_DRAW);
 
-	glBindBuffer(GL_ARRAY_BUFFER, b->buffers[0]);
-	glVertexAttribPointer(ATTR_LOCATION_POSITION, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-	glBindBuffer(GL_ARRAY_BUFFER, b->buffers[1]);
-	glVertexAttribPointer(ATTR_LOCATION_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
-
-	if (b->has_texture) {
-		glBindBuffer(GL_ARRAY_BUFFER, b->buffers[2]);
-		glEnableVertexAttribArray(ATTR_LOCATION_TEXCOORD);
-		glVertexAttribPointer(ATTR_LOCATION_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-	}
+	gl_bind_buffer(GL_ARRAY_BUFFER, b->vbo);
+	gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_indices);
+	// the texture coordinates are disabled otherwise, they may point outside of the vbo
+	gl_vertex_attrib_array(ATTR_LOCATION_TEXCOORD, b->has_texture);
+	gl_vertex_attrib_array(ATTR_LOCATION_COLOR, !b->constant_color);
+	if (b->constant_color)
+		glVertexAttrib4f(ATTR_LOCATION_COLOR, b->color[0] / 255.f, b->color[1] / 255.f,
+		                 b->color[2] / 255.f, b->color[3] / 255.f);
 
 	dx -= b->camera->dx;
 	dy -= b->camera->dy;
-	glUniform1f(shader->vars[locationIndex].dxLocation, dx);
-	glUniform1f(shader->vars[locationIndex].dyLocation, dy);
-	glUniform1f(shader->vars[locationIndex].zoomLocation, b->camera->zoom);
-	glUniformMatrix2fv(shader->vars[locationIndex].rotationMatrixLocation, 1, GL_FALSE, b->camera->matrix);
-	glUniform2f(shader->vars[locationIndex].destinationSizeLocation, b->draw_on->texw, b->draw_on->texh);
+	ShaderVars *vars = &shader->programs[locationIndex]->vars;
+	gl_uniform1f(vars->dxLocation, &vars->dx, dx);
+	gl_uniform1f(vars->dyLocation, &vars->dy, dy);
+	gl_uniform1f(vars->zoomLocation, &vars->zoom, b->camera->zoom);
+	if (b->draw_on->backbuffer) {
+		// the default framebuffer has its origin at the bottom left
+		const float *m = b->camera->matrix;
+		const float flipped[4] = {m[0], -m[1], m[2], -m[3]};
+		gl_uniform_matrix2fv(vars->rotationMatrixLocation, vars->rotationMatrix, flipped);
+	} else {
+		gl_uniform_matrix2fv(vars->rotationMatrixLocation, vars->rotationMatrix, b->camera->matrix);
+	}
+	gl_uniform2f(vars->destinationSizeLocation, vars->destinationSize, b->draw_on->texw, b->draw_on->texh);
 	if (b->draw_from)
-		glUniform2f(shader->vars[locationIndex].sourceSizeLocation, b->draw_from->texw, b->draw_from->texh);
-
-	glDrawArrays(GL_TRIANGLES, 0, used);
-
-	if (b->has_texture) {
-		glDisableVertexAttribArray(ATTR_LOCATION_TEXCOORD);
+		gl_uniform2f(vars->sourceSizeLocation, vars->sourceSize, b->draw_from->texw, b->draw_from->texh);
+
+	// GLushort indices cannot address more than BUFFER_INDEXED_VERTICES vertices,
+	// so big user buffers are drawn in several parts
+	for (size_t first = 0; first < used; first += BUFFER_INDEXED_VERTICES) {
+		size_t count = MIN(used - first, (size_t) BUFFER_INDEXED_VERTICES);
+		buffer_set_attributes(b, offset + first * sizeof(Vertex));
+		glDrawElements(GL_TRIANGLES, count / 4 * 6, GL_UNSIGNED_SHORT, NULL);
+		stats.draw_calls++;
+		stats.vertices += count;
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+const BufferStats *buffer_get_stats(void)
+{
+	return &last_stats;
+}
+
+void buffer_stats_next_frame(void)
+{
+	last_stats = stats;
+	memset(&stats, 0, sizeof(stats));
+}
@@ -32,72 +32,140 @@ typedef struct Buffer Buffer;
 #include "camera.h"
 #include "surface.h"
 
-// should be multiple of 3 (GL_TRIANGLES)
-#define BUFFER_DEFAULT_SIZE 3 * 4096
+// should be multiple of 4 (quads)
+#define BUFFER_DEFAULT_SIZE 4 * 4096
+// size of the VBO in which the default buffer streams its vertices, in vertices
+#define BUFFER_STREAM_SIZE (8 * BUFFER_DEFAULT_SIZE)
+// number of vertices addressable by the shared index buffer (GLushort indices)
+#define BUFFER_INDEXED_VERTICES 65536
+
+typedef struct Vertex Vertex;
+typedef struct BufferStats BufferStats;
+
+// why the vertices of a buffer had to be drawn (or recorded, in deferred mode)
+enum FlushCause {
+	FLUSH_OTHER = 0,
+	FLUSH_TEXTURE, // draw_from changed, or switched between textured and non textured primitives
+	FLUSH_SHADER,
+	FLUSH_BLEND,
+	FLUSH_CAMERA,
+	FLUSH_FULL,
+	FLUSH_DRAW_ON,
+	FLUSH_CAUSE_COUNT,
+};
+typedef enum FlushCause FlushCause;
+
+// interleaved vertex, uploaded as a whole in a single VBO
+// vertices are grouped by four and drawn as quads (0 1 2, 0 2 3) using the
+// shared index buffer, a triangle is pushed with its last vertex repeated
+struct Vertex {
+	GLfloat x;
+	GLfloat y;
+	GLubyte r;
+	GLubyte g;
+	GLubyte b;
+	GLubyte a;
+	GLfloat u; // texcoords, only used if has_texture
+	GLfloat v;
+};
 
 struct Buffer {
 	unsigned int size;
-	GLuint buffers[3]; // first is for positions, second for colors, third (optional) for texcoords
-	GLfloat* positions;
-	GLubyte* colors;
-	GLfloat* tex_coords; // only if has_texture
-	unsigned int current_position;
-	unsigned int current_color;
-	unsigned int current_tex_coord;
+	GLuint vbo;
+	Vertex* vertices;
+	unsigned int current_vertex;
 	bool uploaded;
 
+	// the default buffer appends its vertices to a preallocated VBO with
+	// glBufferSubData, and orphans the storage only when it is full
+	bool stream;
+	unsigned int stream_offset; // in vertices
+
 	bool has_texture;
+	// if set, the color of the vertices is ignored and 'color' is used for all of them
+	bool constant_color;
+	GLubyte color[4];
 	Shader* shader;
 	Camera* camera;
 	bool user_buffer;
 
 	int ref;
-	const Surface* draw_on;
-	const Surface* draw_from;
+	Surface* draw_on;
+	Surface* draw_from;
+
+	// if set, flushes are recorded in this list instead of being drawn
+	struct BatchList *batches;
+};
+
+struct BufferStats {
+	unsigned int flushes;
+	unsigned int flushes_by_cause[FLUSH_CAUSE_COUNT];
+	unsigned int draw_calls;
+	unsigned long vertices;
+	unsigned int uploads;
+	unsigned long bytes_uploaded;
+	unsigned int orphans;
 };
 
+void buffer_create_quad_indices(void);
+void buffer_free_quad_indices(void);
+
 Buffer *buffer_new(bool user_buffer, unsigned int size);
 void buffer_free(Buffer *b);
 void buffer_allocate(Buffer *b);
 
-void buffer_push_vertex(Buffer *b, GLfloat, GLfloat);
-void buffer_push_color(Buffer *b, GLubyte, GLubyte, GLubyte, GLubyte);
-void buffer_push_tex_coord(Buffer *b, GLfloat, GLfloat);
-
 void buffer_draw(Buffer *b, float dx, float dy);
+void buffer_flush(Buffer *b, FlushCause cause);
 
-void buffer_check_empty(Buffer *b);
+void buffer_check_empty(Buffer *b, FlushCause cause);
 void buffer_check_use_texture(Buffer *b);
 void buffer_check_not_use_texture(Buffer *b);
 void buffer_check_not_full(Buffer *b);
 
 void buffer_upload_and_free(Buffer *b);
 
+const BufferStats *buffer_get_stats(void);
+void buffer_stats_next_frame(void);
+
 static inline bool buffer_was_freed(const Buffer *b)
 {
-	return b->positions == NULL;
+	return b->vertices == NULL;
 }
 
 static inline void buffer_reset(Buffer *b)
 {
 	assert(b);
 
-	b->current_position = b->current_color = b->current_tex_coord = 0;
+	b->current_vertex = 0;
 }
 
-static inline bool buffer_is_empty(Buffer *b)
+static inline bool buffer_is_empty(const Buffer *b)
 {
 	assert(b);
 
-	return !b->current_position;
+	return !b->current_vertex;
 }
 
-static inline void buffer_flush(Buffer *b)
+static inline void buffer_push_vertex(Buffer *buffer, GLfloat x, GLfloat y,
+                                      GLubyte r, GLubyte g, GLubyte b, GLubyte a,
+                                      GLfloat u, GLfloat v)
 {
-	assert(b);
-
-	buffer_draw(b, 0, 0);
-	buffer_reset(b);
+	Vertex *vertex;
+
+	assert(buffer);
+	assert(buffer->current_vertex < buffer->size);
+
+	vertex = buffer->vertices + buffer->current_vertex;
+	vertex->x = x;
+	vertex->y = y;
+	vertex->r = r;
+	vertex->g = g;
+	vertex->b = b;
+	vertex->a = a;
+	vertex->u = u;
+	vertex->v = v;
+	buffer->current_vertex += 1;
+	buffer->uploaded = false;
 }
 
 static inline void buffer_use_shader(Buffer *b, Shader *s)
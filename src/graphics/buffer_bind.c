@@ -103,3 +103,48 @@ int mlua_free_buffer(lua_State* L)
 	return 0;
 }
 
+
+int mlua_get_render_stats(lua_State* L)
+{
+	assert(L);
+
+	static const char * const causes[FLUSH_CAUSE_COUNT] = {
+		[FLUSH_OTHER] = "other",
+		[FLUSH_TEXTURE] = "texture",
+		[FLUSH_SHADER] = "shader",
+		[FLUSH_BLEND] = "blend",
+		[FLUSH_CAMERA] = "camera",
+		[FLUSH_FULL] = "full",
+		[FLUSH_DRAW_ON] = "draw_on",
+	};
+	const BufferStats *stats = buffer_get_stats();
+
+	lua_newtable(L);
+	lua_pushinteger(L, stats->flushes);
+	lua_setfield(L, -2, "flushes");
+	lua_newtable(L);
+	for (int i = 0; i < FLUSH_CAUSE_COUNT; i++) {
+		lua_pushinteger(L, stats->flushes_by_cause[i]);
+		lua_setfield(L, -2, causes[i]);
+	}
+	lua_setfield(L, -2, "flush_causes");
+	lua_pushinteger(L, stats->draw_calls);
+	lua_setfield(L, -2, "draw_calls");
+	lua_pushnumber(L, stats->vertices);
+	lua_setfield(L, -2, "vertices");
+	lua_pushinteger(L, stats->uploads);
+	lua_setfield(L, -2, "uploads");
+	lua_pushnumber(L, stats->bytes_uploaded);
+	lua_setfield(L, -2, "bytes_uploaded");
+	lua_pushinteger(L, stats->orphans);
+	lua_setfield(L, -2, "orphans");
+
+	const DisplayStats *display_stats = display_get_stats();
+	lua_pushinteger(L, display_stats->texture_binds);
+	lua_setfield(L, -2, "texture_binds");
+	lua_pushinteger(L, display_stats->culled);
+	lua_setfield(L, -2, "culled");
+	lua_pushinteger(L, display_stats->submitted);
+	lua_setfield(L, -2, "submitted");
+	return 1;
+}
@@ -31,3 +31,5 @@ int mlua_reset_buffer(lua_State* L);
 int mlua_upload_and_free_buffer(lua_State* L);
 int mlua_free_buffer(lua_State* L);
 
+int mlua_get_render_stats(lua_State* L);
+
@@ -57,6 +57,49 @@ void camera_update_matrix(Camera *c, int width, int height)
 	c->matrix[3] = cosf(angle);
 }
 
+/**
+ * Computes where the point (x, y) ends up in normalized device coordinates
+ * when drawn on a destination of size (width, height), like the vertex shader does.
+ */
+void camera_project(const Camera *c, float width, float height, float x, float y, float *px, float *py)
+{
+	float vx, vy;
+
+	assert(c);
+	assert(px);
+	assert(py);
+
+	vx = 2 * (x - c->dx) / width - 1;
+	vy = 2 * (y - c->dy) / height - 1;
+	*px = c->zoom * (c->matrix[0] * vx + c->matrix[2] * vy);
+	*py = c->zoom * (c->matrix[1] * vx + c->matrix[3] * vy);
+}
+
+/**
+ * Inverse of camera_project: computes which point is drawn at (px, py)
+ * in normalized device coordinates. Returns false if the camera is degenerated
+ * (zoom of 0), in which case the point is undefined.
+ */
+bool camera_unproject(const Camera *c, float width, float height, float px, float py, float *x, float *y)
+{
+	float det;
+	float vx, vy;
+
+	assert(c);
+	assert(x);
+	assert(y);
+
+	det = (c->matrix[0] * c->matrix[3] - c->matrix[2] * c->matrix[1]) * c->zoom;
+	if (det == 0)
+		return false;
+
+	vx = (c->matrix[3] * px - c->matrix[2] * py) / det;
+	vy = (c->matrix[0] * py - c->matrix[1] * px) / det;
+	*x = (vx + 1) * width / 2 + c->dx;
+	*y = (vy + 1) * height / 2 + c->dy;
+	return true;
+}
+
 void camera_reset(Camera *c)
 {
 	assert(c);
@@ -32,6 +32,8 @@ Camera *camera_new(void);
 void camera_free(Camera *c);
 
 void camera_update_matrix(Camera *c, int width, int height);
+void camera_project(const Camera *c, float width, float height, float x, float y, float *px, float *py);
+bool camera_unproject(const Camera *c, float width, float height, float px, float py, float *x, float *y);
 void camera_reset(Camera *c);
 void camera_push(Camera *c);
 void camera_pop(Camera *c);
@@ -27,6 +27,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
+#include <string.h>
 
 #include "display.h"
 #include "log.h"
@@ -34,6 +35,8 @@
 #include "surface.h"
 #include "camera.h"
 #include "buffer.h"
+#include "batch.h"
+#include "tilemap.h"
 #include "util.h"
 #include "opengl_util.h"
 
@@ -53,17 +56,47 @@ static struct Display {
 
 	Buffer *current_buffer;
 
+	BlendMode blend_mode;
+
 	unsigned char r;
 	unsigned char g;
 	unsigned char b;
 	unsigned char alpha;
 
 	Camera *camera;
+	// camera of the default buffer when the camera is applied on the CPU, always the identity
+	Camera *identity_camera;
+	// vertices pushed to the default buffer are transformed by the camera before being stored,
+	// so changing the camera does not flush the default buffer
+	bool cpu_camera;
+	// transform of the camera from world to destination coordinates, if !transform_dirty
+	bool transform_dirty;
+	float transform[6];
 
 	int original_width;
 	int original_height;
 
 	bool debug_mode;
+	// no window: the screen surface is never presented
+	bool headless;
+
+	// primitives fully outside of current_on are not pushed to the default buffer
+	bool culling;
+	// part of the world visible through the camera, if !cull_dirty
+	bool cull_dirty;
+	float cull_xmin;
+	float cull_ymin;
+	float cull_xmax;
+	float cull_ymax;
+	// of the frame being drawn, and of the last complete frame
+	DisplayStats stats;
+	DisplayStats last_stats;
+
+	// scratch arrays used to tessellate the shapes
+	float *shape_points;
+	size_t shape_points_size;
+	unsigned int *shape_indices;
+	size_t shape_indices_size;
 } display;
 
 static Shader *display_create_default_shader()
@@ -89,9 +122,12 @@ static int display_create_window(int w, int h)
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+	Uint32 flags = SDL_WINDOW_OPENGL;
+	if (display.headless)
+		flags |= SDL_WINDOW_HIDDEN;
 	display.sdl_window = SDL_CreateWindow("Drystal",
 	                                      SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-	                                      w, h, SDL_WINDOW_OPENGL);
+	                                      w, h, flags);
 	if (!display.sdl_window) {
 		return -1;
 	}
@@ -101,8 +137,11 @@ static int display_create_window(int w, int h)
 	display.original_height = h;
 	SDL_SetVideoMode(w, h, 32, SDL_OPENGL);
 #endif
+	gl_state_reset();
 
-	SDL_GL_SetSwapInterval(1);
+	// nothing to synchronize with when nothing is presented
+	if (!display.headless)
+		SDL_GL_SetSwapInterval(1);
 	SDL_GetWindowSize(display.sdl_window, &w, &h);
 
 	display.screen = display_new_surface(w, h, true);
@@ -113,6 +152,7 @@ static int display_create_window(int w, int h)
 		return -1;
 	}
 	display_use_default_shader();
+	buffer_create_quad_indices();
 	buffer_allocate(display.default_buffer);
 
 	display_set_blend_mode(BLEND_DEFAULT);
@@ -124,12 +164,14 @@ static int display_create_window(int w, int h)
 }
 
 
-int display_init(void)
+int display_init(bool headless)
 {
 	int r;
 
 	display.default_buffer = buffer_new(false, BUFFER_DEFAULT_SIZE);
 	display.camera = camera_new();
+	display.identity_camera = camera_new();
+	camera_update_matrix(display.identity_camera, 1, 1);
 	display.sdl_window = NULL;
 	display.gl_context = NULL;
 	display.screen = NULL;
@@ -138,6 +180,7 @@ int display_init(void)
 	display.current_on = NULL;
 	display.current_from = NULL;
 	display.current_buffer = display.default_buffer;
+	display.blend_mode = BLEND_DEFAULT;
 	display.r = 255;
 	display.g = 255;
 	display.b = 255;
@@ -145,7 +188,18 @@ int display_init(void)
 	display.original_width = 0;
 	display.original_height = 0;
 	display.debug_mode = false;
+	display.headless = headless;
+	display.culling = false;
+	display.cull_dirty = true;
+	display.cpu_camera = false;
+	display.transform_dirty = true;
 
+#ifndef EMSCRIPTEN
+	// the offscreen driver creates its GL ES context with EGL (surfaceless or pbuffer),
+	// it does not need a display server
+	if (headless)
+		SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+#endif
 	r = SDL_InitSubSystem(SDL_INIT_VIDEO);
 	if (r < 0) {
 		log_error("Failed to initialize SDL video subsystem: %s", SDL_GetError());
@@ -169,11 +223,22 @@ void display_free()
 	display_free_shader(display.default_shader);
 	display.default_shader = NULL;
 
+	batch_list_free(display.default_buffer->batches);
 	buffer_free(display.default_buffer);
 	display.default_buffer = NULL;
+	buffer_free_quad_indices();
 
 	camera_free(display.camera);
 	display.camera = NULL;
+	camera_free(display.identity_camera);
+	display.identity_camera = NULL;
+
+	free(display.shape_points);
+	display.shape_points = NULL;
+	display.shape_points_size = 0;
+	free(display.shape_indices);
+	display.shape_indices = NULL;
+	display.shape_indices_size = 0;
 
 	if (display.gl_context) {
 		SDL_GL_DeleteContext(display.gl_context);
@@ -208,6 +273,172 @@ void display_get_alpha(int *a)
 	*a = display.alpha;
 }
 
+static void display_apply_blend_mode(BlendMode mode)
+{
+	switch (mode) {
+		case BLEND_ALPHA:
+			gl_blend(GL_FUNC_ADD, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			break;
+		case BLEND_MULT:
+			gl_blend(GL_FUNC_ADD, GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA);
+			break;
+		case BLEND_ADD:
+			gl_blend(GL_FUNC_ADD, GL_SRC_ALPHA, GL_ONE);
+			break;
+	}
+}
+
+/**
+ * Deferred drawing
+ */
+
+static void display_replay_group(BatchList *list, BatchGroup *group)
+{
+	Buffer *b = display.default_buffer;
+
+	for (int i = group->first; i >= 0; i = list->batches[i].next) {
+		const Batch *batch = &list->batches[i];
+		const Vertex *vertices = list->vertices + batch->first_vertex;
+		unsigned int remaining = batch->num_vertices;
+
+		while (remaining) {
+			unsigned int n = MIN(remaining, b->size - b->current_vertex);
+
+			memcpy(b->vertices + b->current_vertex, vertices, n * sizeof(Vertex));
+			b->current_vertex += n;
+			b->uploaded = false;
+			vertices += n;
+			remaining -= n;
+			// the flushes were already counted when the batches were recorded
+			if (b->current_vertex == b->size) {
+				buffer_draw(b, 0, 0);
+				buffer_reset(b);
+			}
+		}
+	}
+	buffer_draw(b, 0, 0);
+	buffer_reset(b);
+}
+
+/**
+ * Surface whose texture is bound: for a grid surface, the cell drawn last.
+ */
+static Surface *display_bound_from(void)
+{
+	Surface *from = display.current_from;
+
+	if (from && from->grid)
+		return display.current_buffer->draw_from;
+	return from;
+}
+
+/**
+ * Draws the batches recorded by the default buffer, group by group,
+ * then restores the state of the display.
+ */
+void display_flush_batches(void)
+{
+	Buffer *b = display.default_buffer;
+	BatchList *list = b->batches;
+
+	if (!list)
+		return;
+
+	// vertices still in the default buffer are recorded too
+	buffer_check_empty(b, FLUSH_OTHER);
+	if (batch_list_is_empty(list))
+		return;
+
+	Surface *old_on = b->draw_on;
+	Surface *old_from = b->draw_from;
+	Shader *old_shader = b->shader;
+	Camera *old_camera = b->camera;
+	bool old_has_texture = b->has_texture;
+	Surface *bound_on = display.current_on;
+	BlendMode blend = display.blend_mode;
+
+	b->batches = NULL;
+	for (unsigned int i = 0; i < list->num_groups; i++) {
+		BatchGroup *group = &list->groups[i];
+		Batch *first = &list->batches[group->first];
+
+		if (first->draw_on != bound_on) {
+			bound_on = first->draw_on;
+			surface_draw_on(bound_on);
+			glViewport(0, 0, bound_on->w, bound_on->h);
+		}
+		// always bind, the texture may need new mipmaps since it was recorded
+		if (first->has_texture) {
+			surface_draw_from(first->draw_from);
+			display.stats.texture_binds++;
+		}
+		if (first->blend != blend) {
+			blend = first->blend;
+			display_apply_blend_mode(blend);
+		}
+
+		b->draw_on = first->draw_on;
+		b->draw_from = first->draw_from;
+		b->shader = first->shader;
+		b->camera = &first->camera;
+		b->has_texture = first->has_texture;
+		display_replay_group(list, group);
+	}
+
+	if (display.current_on && bound_on != display.current_on) {
+		surface_draw_on(display.current_on);
+		glViewport(0, 0, display.current_on->w, display.current_on->h);
+	}
+	Surface *from = display_bound_from();
+	if (from) {
+		surface_draw_from(surface_get_texture_owner(from));
+	} else {
+		gl_bind_texture(0);
+	}
+	if (blend != display.blend_mode)
+		display_apply_blend_mode(display.blend_mode);
+
+	b->draw_on = old_on;
+	b->draw_from = old_from;
+	b->shader = old_shader;
+	b->camera = old_camera;
+	b->has_texture = old_has_texture;
+	b->batches = list;
+	batch_list_clear(list);
+}
+
+static void display_check_batches(void)
+{
+	BatchList *list = display.default_buffer->batches;
+
+	if (list && batch_list_is_full(list))
+		display_flush_batches();
+}
+
+void display_set_deferred(bool deferred)
+{
+	Buffer *b = display.default_buffer;
+
+	if (deferred == !!b->batches)
+		return;
+
+	if (deferred) {
+		buffer_check_empty(b, FLUSH_OTHER);
+		b->batches = batch_list_new();
+		b->batches->blend = display.blend_mode;
+		b->batches->default_shader = display.default_shader;
+	} else {
+		display_flush_batches();
+		batch_list_free(b->batches);
+		b->batches = NULL;
+	}
+}
+
+bool display_is_deferred(void)
+{
+	return display.default_buffer->batches != NULL;
+}
+
 /**
  * Screen
  */
@@ -219,6 +450,17 @@ void display_set_title(const char *title)
 	SDL_SetWindowTitle(display.sdl_window, title);
 }
 
+static void display_replace_screen(int w, int h)
+{
+	bool direct = display.screen->backbuffer;
+
+	// freed by lua's gc
+	display.screen = display_new_surface(w, h, true);
+	if (direct)
+		surface_attach_backbuffer(display.screen);
+	display_draw_on(display.screen);
+}
+
 void display_set_fullscreen(bool fullscreen)
 {
 	if (fullscreen) {
@@ -229,9 +471,7 @@ void display_set_fullscreen(bool fullscreen)
 		SDL_SetWindowFullscreen(display.sdl_window, SDL_WINDOW_FULLSCREEN_DESKTOP);
 #endif
 		SDL_GetWindowSize(display.sdl_window, &w, &h);
-		// freed by lua's gc
-		display.screen = display_new_surface(w, h, true);
-		display_draw_on(display.screen);
+		display_replace_screen(w, h);
 	} else {
 #ifndef EMSCRIPTEN
 		SDL_SetWindowFullscreen(display.sdl_window, SDL_FALSE);
@@ -260,9 +500,7 @@ void display_resize(int w, int h)
 	                      posy + currenth / 2 - h / 2); // and move it back
 #endif
 	SDL_GetWindowSize(display.sdl_window, &w, &h);
-	// freed by lua's gc
-	display.screen = display_new_surface(w, h, true);
-	display_draw_on(display.screen);
+	display_replace_screen(w, h);
 }
 
 void display_screen2scene(float x, float y, float * tx, float * ty)
@@ -308,16 +546,23 @@ void display_show_cursor(bool b)
 
 void display_draw_background()
 {
-	buffer_check_empty(display.current_buffer);
+	buffer_check_empty(display.current_buffer, FLUSH_OTHER);
+	display_flush_batches();
 	glClearColor(display.r / 255.f, display.g / 255.f, display.b / 255.f, display.alpha / 255.f);
 	glClear(GL_COLOR_BUFFER_BIT);
+	if (display.current_on)
+		surface_mark_all_stale(display.current_on);
 }
 
-void display_flip()
+/**
+ * Draws `from` reversed vertically on the whole framebuffer `fbo`, using
+ * the default context (buffer, color, no debug, etc).
+ * `from` must have the size of the surface currently drawn on.
+ */
+static void display_draw_reversed(Surface *from, GLuint fbo)
 {
-	GLDEBUG();
-
 	// save context
+	BatchList *batches = display.default_buffer->batches;
 	Surface *oldfrom = display.current_from;
 	Buffer *oldbuffer = display.current_buffer;
 	unsigned char oldr = display.r;
@@ -327,25 +572,25 @@ void display_flip()
 	bool olddebug = display.debug_mode;
 	Camera oldcamera = *display.camera;
 
-	// draw 'screen' on real screen, using default context (buffer, color, no debug, etc)
 	display_use_default_buffer();
-	display_draw_from(display.screen);
+	display_draw_from(from);
 	display_use_default_shader();
 	display_set_color(255, 255, 255);
 	display_set_alpha(255);
 	display_reset_camera();
-	float w = display.screen->w;
-	float h = display.screen->h;
+	float w = from->w;
+	float h = from->h;
 	display.debug_mode = false;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	display.default_buffer->batches = NULL;
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 	glClearColor(0., 0., 0., 1.);
 	glClear(GL_COLOR_BUFFER_BIT);
 	display_draw_quad(0, 0, w, 0, w, h, 0, h,
 	                  0, h, w, h, w, 0, 0, 0); // y reversed
-	buffer_check_empty(display.current_buffer);
-	SDL_GL_SwapWindow(display.sdl_window);
+	buffer_check_empty(display.current_buffer, FLUSH_OTHER);
 
 	// restore context
+	display.default_buffer->batches = batches;
 	surface_draw_on(display.current_on);
 	display_draw_from(oldfrom);
 	display_use_buffer(oldbuffer);
@@ -357,10 +602,103 @@ void display_flip()
 	display_set_camera_angle(oldcamera.angle);
 	display_set_camera_position(oldcamera.dx, oldcamera.dy);
 	display_set_camera_zoom(oldcamera.zoom);
+}
+
+static void display_next_frame_stats(void)
+{
+	buffer_stats_next_frame();
+	display.last_stats = display.stats;
+	memset(&display.stats, 0, sizeof(DisplayStats));
+}
+
+void display_flip()
+{
+	GLDEBUG();
+
+	display_flush_batches();
+
+	if (display.headless) {
+		buffer_check_empty(display.default_buffer, FLUSH_OTHER);
+		// no swap to wait for, make frame times include the rendering
+		glFinish();
+		display_next_frame_stats();
+		return;
+	}
+
+	if (display.screen->backbuffer) {
+		// 'screen' is already the real screen
+		buffer_check_empty(display.default_buffer, FLUSH_OTHER);
+		SDL_GL_SwapWindow(display.sdl_window);
+		display_next_frame_stats();
+		return;
+	}
+
+	// draw 'screen' on real screen
+	display_draw_reversed(display.screen, 0);
+	SDL_GL_SwapWindow(display.sdl_window);
+	display_next_frame_stats();
 
 	GLDEBUG();
 }
 
+/**
+ * Direct rendering
+ *
+ * The screen surface is drawn on the default framebuffer, which saves the copy
+ * done by display_flip. The screen goes back to an offscreen surface as soon as
+ * its texture is needed (draw_from or get_pixel).
+ */
+
+void display_set_direct_rendering(bool direct)
+{
+	Surface *screen = display.screen;
+
+	if (direct == screen->backbuffer)
+		return;
+
+	if (!direct) {
+		display_leave_direct_rendering();
+		return;
+	}
+
+	display_flush_batches();
+	buffer_check_empty(display.default_buffer, FLUSH_DRAW_ON);
+	Surface *old_on = display.current_on;
+	display_draw_on(screen);
+	// keep what was already drawn this frame
+	display_draw_reversed(screen, 0);
+	surface_attach_backbuffer(screen);
+	surface_draw_on(screen);
+	display_draw_on(old_on);
+}
+
+void display_leave_direct_rendering(void)
+{
+	Surface *screen = display.screen;
+
+	if (!screen->backbuffer)
+		return;
+
+	log_debug("Leave direct rendering");
+	display_flush_batches();
+	buffer_check_empty(display.default_buffer, FLUSH_DRAW_ON);
+
+	int w = screen->w;
+	int h = screen->h;
+	Surface *copy = display_create_surface(w, h, w, h, NULL);
+	surface_draw_from(copy);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, w, h);
+
+	Surface *old_on = display.current_on;
+	surface_detach_backbuffer(screen);
+	surface_draw_on(screen);
+	display_draw_on(screen);
+	display_draw_reversed(copy, screen->fbo);
+	display_draw_on(old_on);
+	display_free_surface(copy);
+}
+
 Surface *display_get_screen()
 {
 	return display.screen;
@@ -400,29 +738,21 @@ void display_set_alpha(int a)
 
 void display_set_blend_mode(BlendMode mode)
 {
-	buffer_check_empty(display.current_buffer);
+	buffer_check_empty(display.current_buffer, FLUSH_BLEND);
+	display_check_batches();
 
-	switch (mode) {
-		case BLEND_ALPHA:
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-			glBlendEquation(GL_FUNC_ADD);
-			break;
-		case BLEND_MULT:
-			glBlendFunc(GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA);
-			glBlendEquation(GL_FUNC_ADD);
-			break;
-		case BLEND_ADD:
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-			glBlendEquation(GL_FUNC_ADD);
-			break;
-	}
+	display.blend_mode = mode;
+	if (display.default_buffer->batches)
+		display.default_buffer->batches->blend = mode;
+	display_apply_blend_mode(mode);
 }
 
 void display_set_filter(Surface* surface, FilterMode filter)
 {
 	assert(surface);
 
-	surface_set_filter(surface, filter, display.current_from);
+	display_flush_batches();
+	surface_set_filter(surface_get_texture_owner(surface), filter, display_bound_from());
 }
 
 void display_get_pixel(Surface* surface, unsigned int x, unsigned int y,
@@ -430,17 +760,74 @@ void display_get_pixel(Surface* surface, unsigned int x, unsigned int y,
 {
 	assert(surface);
 
+	if (surface == display.screen)
+		display_leave_direct_rendering();
+	display_flush_batches();
 	surface_get_pixel(surface, x, y, red, green, blue, alpha, display.current_on);
 }
 
+void display_get_pixels(Surface* surface, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+                        unsigned char *pixels)
+{
+	assert(surface);
+	assert(pixels);
+
+	if (surface == display.screen)
+		display_leave_direct_rendering();
+	display_flush_batches();
+	surface_get_pixels(surface, x, y, w, h, pixels, display.current_on);
+}
+
+void display_lock_surface(Surface* surface)
+{
+	assert(surface);
+
+	if (surface == display.screen)
+		display_leave_direct_rendering();
+	display_flush_batches();
+	surface_lock(surface, display.current_on);
+}
+
+void display_unlock_surface(Surface* surface)
+{
+	assert(surface);
+
+	// primitives submitted before the unlock use the old pixels
+	display_flush_batches();
+	if (display.current_from == surface)
+		buffer_check_empty(display.current_buffer, FLUSH_TEXTURE);
+	surface_unlock(surface, display_bound_from());
+}
+
 Camera *display_get_camera()
 {
 	return display.camera;
 }
 
+static bool display_camera_on_cpu(void)
+{
+	return display.cpu_camera && !display.current_buffer->user_buffer;
+}
+
+/**
+ * Called before the camera changes. Vertices already pushed to the default buffer
+ * keep their transform if the camera is applied on the CPU, otherwise they are drawn
+ * with the old camera first.
+ */
+static void display_camera_will_change(void)
+{
+	display.cull_dirty = true;
+	display.transform_dirty = true;
+	if (display_camera_on_cpu())
+		return;
+
+	buffer_check_empty(display.current_buffer, FLUSH_CAMERA);
+	display_check_batches();
+}
+
 void display_reset_camera()
 {
-	buffer_check_empty(display.current_buffer);
+	display_camera_will_change();
 
 	camera_reset(display.camera);
 	camera_update_matrix(display.camera, display.current_on->w, display.current_on->h);
@@ -448,14 +835,14 @@ void display_reset_camera()
 
 void display_push_camera()
 {
-	buffer_check_empty(display.current_buffer);
+	display_camera_will_change();
 
 	camera_push(display.camera);
 }
 
 void display_pop_camera()
 {
-	buffer_check_empty(display.current_buffer);
+	display_camera_will_change();
 
 	camera_pop(display.camera);
 	camera_update_matrix(display.camera, display.current_on->w, display.current_on->h);
@@ -463,7 +850,7 @@ void display_pop_camera()
 
 void display_set_camera_position(float dx, float dy)
 {
-	buffer_check_empty(display.current_buffer);
+	display_camera_will_change();
 
 	display.camera->dx = dx;
 	display.camera->dy = dy;
@@ -473,7 +860,7 @@ void display_set_camera_position(float dx, float dy)
 
 void display_set_camera_angle(float angle)
 {
-	buffer_check_empty(display.current_buffer);
+	display_camera_will_change();
 
 	display.camera->angle = angle;
 	camera_update_matrix(display.camera, display.current_on->w, display.current_on->h);
@@ -481,11 +868,28 @@ void display_set_camera_angle(float angle)
 
 void display_set_camera_zoom(float zoom)
 {
-	buffer_check_empty(display.current_buffer);
+	display_camera_will_change();
 
 	display.camera->zoom = zoom;
 }
 
+void display_set_cpu_camera(bool cpu_camera)
+{
+	if (display.cpu_camera == cpu_camera)
+		return;
+
+	buffer_check_empty(display.default_buffer, FLUSH_CAMERA);
+	display_check_batches();
+	display.cpu_camera = cpu_camera;
+	display.transform_dirty = true;
+	buffer_use_camera(display.default_buffer, cpu_camera ? display.identity_camera : display.camera);
+}
+
+bool display_is_cpu_camera(void)
+{
+	return display.cpu_camera;
+}
+
 Surface *display_get_draw_on()
 {
 	return display.current_on;
@@ -496,26 +900,61 @@ Surface *display_get_draw_from()
 	return display.current_from;
 }
 
+static Surface *display_get_texture(Surface *surface)
+{
+	return surface ? surface_get_texture_owner(surface) : NULL;
+}
+
 void display_draw_from(Surface *surface)
 {
-	if (display.current_from != surface) {
-		buffer_check_empty(display.current_buffer);
-		display.current_from = surface;
-		if (surface) {
-			surface_draw_from(surface);
+	if (surface && surface->backbuffer)
+		display_leave_direct_rendering();
+
+	Surface *texture = display_get_texture(surface);
+
+	// surfaces packed in the same atlas page do not need a flush
+	if (display_get_texture(display.current_from) != texture) {
+		buffer_check_empty(display.current_buffer, FLUSH_TEXTURE);
+		display_check_batches();
+		if (texture && texture->grid) {
+			// the cells are bound when they are drawn
+			texture = NULL;
+		}
+		if (texture) {
+			surface_draw_from(texture);
+			display.stats.texture_binds++;
 		} else {
-			glBindTexture(GL_TEXTURE_2D, 0);
+			gl_bind_texture(0);
 		}
-		display.current_buffer->draw_from = display.current_from;
+		display.current_buffer->draw_from = texture;
 	}
+	display.current_from = surface;
+}
+
+/**
+ * Binds a cell of the current grid surface.
+ */
+static void display_draw_from_cell(Surface *cell)
+{
+	if (display.current_buffer->draw_from != cell) {
+		buffer_check_empty(display.current_buffer, FLUSH_TEXTURE);
+		display_check_batches();
+		display.current_buffer->draw_from = cell;
+		display.stats.texture_binds++;
+	}
+	surface_draw_from(cell);
 }
 
 void display_draw_on(Surface *surface)
 {
 	assert(surface);
+	assert(!surface->page);
 	if (display.current_on != surface) {
-		buffer_check_empty(display.current_buffer);
+		buffer_check_empty(display.current_buffer, FLUSH_DRAW_ON);
+		display_check_batches();
 		display.current_on = surface;
+		display.cull_dirty = true;
+		display.transform_dirty = true;
 		surface_draw_on(surface);
 
 		int w = surface->w;
@@ -531,12 +970,17 @@ void display_draw_on(Surface *surface)
  */
 Surface *display_create_surface(unsigned int w, unsigned int h, unsigned int texw, unsigned int texh, unsigned char* pixels)
 {
-	return surface_new(w, h, texw, texh, FORMAT_RGBA, pixels, display.current_from, display.current_on);
+	return surface_new(w, h, texw, texh, FORMAT_RGBA, pixels, display_bound_from(), display.current_on);
 }
 
-int display_load_surface(const char * filename, Surface **surface)
+int display_load_surface(const char * filename, Surface **surface, bool atlas)
 {
-	return surface_load(filename, surface, display.current_from);
+	return surface_load(filename, surface, atlas, display_bound_from(), display.current_on);
+}
+
+Surface *display_upload_surface(const char *filename, const SurfaceImage *image, bool atlas)
+{
+	return surface_upload(filename, image, atlas, display_bound_from(), display.current_on);
 }
 
 Surface *display_new_surface(int w, int h, bool force_npot)
@@ -563,32 +1007,213 @@ void display_free_surface(Surface* surface)
 	if (!surface)
 		return;
 
+	display_flush_batches();
 	if (surface == display.current_from) {
 		buffer_check_not_use_texture(display.current_buffer);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		gl_bind_texture(0);
+		if (surface->grid)
+			display.current_buffer->draw_from = NULL;
 		display.current_from = NULL;
 	}
 	if (surface == display.current_on) {
-		buffer_check_empty(display.current_buffer);
+		buffer_check_empty(display.current_buffer, FLUSH_OTHER);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		display.current_on = NULL;
 	}
 	surface_free(surface);
 }
 
+/**
+ * Culling
+ */
+
+void display_set_culling(bool culling)
+{
+	display.culling = culling;
+}
+
+const DisplayStats *display_get_stats(void)
+{
+	return &display.last_stats;
+}
+
+static void display_update_cull_region(void)
+{
+	const Camera *camera = display.camera;
+	float w = display.current_on->texw;
+	float h = display.current_on->texh;
+	float x, y;
+
+	display.cull_dirty = false;
+	display.cull_xmin = display.cull_ymin = INFINITY;
+	display.cull_xmax = display.cull_ymax = -INFINITY;
+	for (int i = 0; i < 4; i++) {
+		if (!camera_unproject(camera, w, h, i & 1 ? 1 : -1, i & 2 ? 1 : -1, &x, &y)) {
+			// nothing is visible, but do not cull anything in this strange case
+			display.cull_xmin = display.cull_ymin = -INFINITY;
+			display.cull_xmax = display.cull_ymax = INFINITY;
+			return;
+		}
+		display.cull_xmin = MIN(display.cull_xmin, x);
+		display.cull_xmax = MAX(display.cull_xmax, x);
+		display.cull_ymin = MIN(display.cull_ymin, y);
+		display.cull_ymax = MAX(display.cull_ymax, y);
+	}
+}
+
+/**
+ * Marks the bounding box (in world coordinates) of a primitive drawn on the current surface
+ * as stale in its CPU copy, if it has one.
+ */
+static void display_mark_drawn(float xmin, float ymin, float xmax, float ymax)
+{
+	Surface *on = display.current_on;
+	float w = on->texw;
+	float h = on->texh;
+	float pxmin = INFINITY, pymin = INFINITY;
+	float pxmax = -INFINITY, pymax = -INFINITY;
+
+	if (display.current_shader != display.default_shader) {
+		// the vertex shader can put the primitive anywhere
+		surface_mark_all_stale(on);
+		return;
+	}
+
+	for (int i = 0; i < 4; i++) {
+		float px, py;
+		camera_project(display.camera, w, h, i & 1 ? xmax : xmin, i & 2 ? ymax : ymin, &px, &py);
+		pxmin = MIN(pxmin, px);
+		pxmax = MAX(pxmax, px);
+		pymin = MIN(pymin, py);
+		pymax = MAX(pymax, py);
+	}
+
+	// from normalized device coordinates to pixels, with a margin for the rasterization
+	surface_mark_stale(on, floorf((pxmin + 1) * w / 2) - 1, floorf((pymin + 1) * h / 2) - 1,
+	                   ceilf((pxmax + 1) * w / 2) + 1, ceilf((pymax + 1) * h / 2) + 1);
+}
+
+/**
+ * Tells if the primitive with the given vertices (x1, y1, x2, y2, ...) would not be visible
+ * on the current surface. Primitives pushed in user buffers are never culled since
+ * they are drawn later with another camera.
+ * Visible primitives are marked as drawn on the current surface.
+ */
+static bool display_cull(const float *vertices, int num_vertices)
+{
+	float xmin, ymin, xmax, ymax;
+	bool direct = !display.current_buffer->user_buffer && display.current_on;
+	bool culling = display.culling && direct;
+	bool mark = direct && display.current_on->pixels;
+
+	if (!culling && !mark) {
+		display.stats.submitted++;
+		return false;
+	}
+
+	xmin = xmax = vertices[0];
+	ymin = ymax = vertices[1];
+	for (int i = 1; i < num_vertices; i++) {
+		xmin = MIN(xmin, vertices[i * 2]);
+		xmax = MAX(xmax, vertices[i * 2]);
+		ymin = MIN(ymin, vertices[i * 2 + 1]);
+		ymax = MAX(ymax, vertices[i * 2 + 1]);
+	}
+
+	if (culling) {
+		if (display.cull_dirty)
+			display_update_cull_region();
+
+		if (xmax < display.cull_xmin || xmin > display.cull_xmax
+		    || ymax < display.cull_ymin || ymin > display.cull_ymax) {
+			display.stats.culled++;
+			return true;
+		}
+	}
+
+	if (mark)
+		display_mark_drawn(xmin, ymin, xmax, ymax);
+
+	display.stats.submitted++;
+	return false;
+}
+
+/**
+ * Computes the affine transform applied to the vertices when the camera is on the CPU:
+ * once drawn with the identity camera, a point ends up where the vertex shader would put it
+ * with the camera (see camera_project).
+ */
+static void display_update_transform(void)
+{
+	const Camera *c = display.camera;
+	float w = display.current_on->texw;
+	float h = display.current_on->texh;
+	float vx = -(2 * c->dx / w + 1);
+	float vy = -(2 * c->dy / h + 1);
+
+	display.transform_dirty = false;
+	display.transform[0] = c->zoom * c->matrix[0];
+	display.transform[1] = c->zoom * c->matrix[2] * w / h;
+	display.transform[2] = (c->zoom * (c->matrix[0] * vx + c->matrix[2] * vy) + 1) * w / 2;
+	display.transform[3] = c->zoom * c->matrix[1] * h / w;
+	display.transform[4] = c->zoom * c->matrix[3];
+	display.transform[5] = (c->zoom * (c->matrix[1] * vx + c->matrix[3] * vy) + 1) * h / 2;
+}
+
+static inline void display_push_vertex(Buffer *buffer, float x, float y,
+                                       unsigned char r, unsigned char g, unsigned char b, unsigned char a,
+                                       float u, float v)
+{
+	if (display.cpu_camera && !buffer->user_buffer) {
+		if (display.transform_dirty)
+			display_update_transform();
+		const float *t = display.transform;
+		float tx = t[0] * x + t[1] * y + t[2];
+		y = t[3] * x + t[4] * y + t[5];
+		x = tx;
+	}
+	buffer_push_vertex(buffer, x, y, r, g, b, a, u, v);
+}
+
 /**
  * Primitive drawing
  */
 
+static void display_draw_quad_color(float x1, float y1, float x2, float y2,
+                                    float x3, float y3, float x4, float y4)
+{
+	Buffer *current_buffer = display.current_buffer;
+	unsigned char r = display.r;
+	unsigned char g = display.g;
+	unsigned char b = display.b;
+	unsigned char alpha = display.alpha;
+
+	if (display.debug_mode && !current_buffer->user_buffer) {
+		display_draw_triangle(x1, y1, x2, y2, x3, y3);
+		display_draw_triangle(x1, y1, x3, y3, x4, y4);
+		return;
+	}
+
+	const float vertices[] = {x1, y1, x2, y2, x3, y3, x4, y4};
+	if (display_cull(vertices, 4))
+		return;
+
+	buffer_check_not_use_texture(current_buffer);
+	buffer_check_not_full(current_buffer);
+
+	display_push_vertex(current_buffer, x1, y1, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x2, y2, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x3, y3, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x4, y4, r, g, b, alpha, 0, 0);
+}
+
 void display_draw_point(float x, float y, float size)
 {
 	float hs = size / 2;
-	display_draw_triangle(x - hs, y - hs,
-						  x + hs, y - hs,
-						  x + hs, y + hs);
-	display_draw_triangle(x - hs, y - hs,
-						  x + hs, y + hs,
-						  x - hs, y + hs);
+	display_draw_quad_color(x - hs, y - hs,
+	                        x + hs, y - hs,
+	                        x + hs, y + hs,
+	                        x - hs, y + hs);
 }
 
 void display_draw_point_tex(float sx, float sy, float x, float y, float size)
@@ -622,8 +1247,46 @@ void display_draw_line(float x1, float y1, float x2, float y2, float width)
 	float yy2 = y1 + dy;
 	float yy3 = y2 + dy;
 	float yy4 = y2 - dy;
-	display_draw_triangle(xx1, yy1, xx2, yy2, xx3, yy3);
-	display_draw_triangle(xx1, yy1, xx3, yy3, xx4, yy4);
+	display_draw_quad_color(xx1, yy1, xx2, yy2, xx3, yy3, xx4, yy4);
+}
+
+void display_draw_rect(float x, float y, float w, float h)
+{
+	display_draw_quad_color(x, y, x + w, y, x + w, y + h, x, y + h);
+}
+
+/**
+ * Computes the corners of the rectangle (x, y, w, h) rotated by angle around (x + hx, y + hy).
+ */
+static void display_rotate_rect(float x, float y, float w, float h, float angle, float hx, float hy,
+                                float corners[8])
+{
+	float c = cosf(angle);
+	float s = sinf(angle);
+	float cx = x + hx;
+	float cy = y + hy;
+	// corners relative to the center of rotation
+	float x1 = -hx;
+	float y1 = -hy;
+	float x2 = w - hx;
+	float y2 = h - hy;
+
+	corners[0] = cx + x1 * c - y1 * s;
+	corners[1] = cy + x1 * s + y1 * c;
+	corners[2] = cx + x2 * c - y1 * s;
+	corners[3] = cy + x2 * s + y1 * c;
+	corners[4] = cx + x2 * c - y2 * s;
+	corners[5] = cy + x2 * s + y2 * c;
+	corners[6] = cx + x1 * c - y2 * s;
+	corners[7] = cy + x1 * s + y2 * c;
+}
+
+void display_draw_rect_rotated(float x, float y, float w, float h, float angle, float hx, float hy)
+{
+	float o[8];
+
+	display_rotate_rect(x, y, w, h, angle, hx, hy, o);
+	display_draw_quad_color(o[0], o[1], o[2], o[3], o[4], o[5], o[6], o[7]);
 }
 
 void display_draw_triangle(float x1, float y1, float x2, float y2, float x3, float y3)
@@ -633,7 +1296,6 @@ void display_draw_triangle(float x1, float y1, float x2, float y2, float x3, flo
 	unsigned char g = display.g;
 	unsigned char b = display.b;
 	unsigned char alpha = display.alpha;
-	int i;
 
 	if (display.debug_mode && !current_buffer->user_buffer) {
 		display.debug_mode = false;
@@ -644,14 +1306,484 @@ void display_draw_triangle(float x1, float y1, float x2, float y2, float x3, flo
 		return;
 	}
 
+	const float vertices[] = {x1, y1, x2, y2, x3, y3};
+	if (display_cull(vertices, 3))
+		return;
+
 	buffer_check_not_use_texture(current_buffer);
 	buffer_check_not_full(current_buffer);
 
-	buffer_push_vertex(current_buffer, x1, y1);
-	buffer_push_vertex(current_buffer, x2, y2);
-	buffer_push_vertex(current_buffer, x3, y3);
-	for (i = 0; i < 3; i++)
-		buffer_push_color(current_buffer, r, g, b, alpha);
+	display_push_vertex(current_buffer, x1, y1, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x2, y2, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x3, y3, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x3, y3, r, g, b, alpha, 0, 0);
+}
+
+/**
+ * Shapes
+ *
+ * A shape is culled as a whole, then pushed as a run of quads
+ * (a lone triangle is a quad with its last vertex repeated).
+ */
+
+// maximal distance in pixels between a circle and the polygon drawn for it
+#define DISPLAY_CIRCLE_TOLERANCE 0.25f
+#define DISPLAY_CIRCLE_MIN_SEGMENTS 8
+#define DISPLAY_CIRCLE_MAX_SEGMENTS 512
+// joins of polylines longer than this factor of the half width are beveled
+#define DISPLAY_MITER_LIMIT 2.f
+
+static bool display_begin_shape(float xmin, float ymin, float xmax, float ymax)
+{
+	const float bbox[] = {xmin, ymin, xmax, ymax};
+
+	if (display_cull(bbox, 2))
+		return false;
+
+	buffer_check_not_use_texture(display.current_buffer);
+	return true;
+}
+
+static void display_push_quad_color(float x1, float y1, float x2, float y2,
+                                    float x3, float y3, float x4, float y4)
+{
+	Buffer *current_buffer = display.current_buffer;
+	unsigned char r = display.r;
+	unsigned char g = display.g;
+	unsigned char b = display.b;
+	unsigned char alpha = display.alpha;
+
+	if (display.debug_mode && !current_buffer->user_buffer) {
+		display_draw_triangle(x1, y1, x2, y2, x3, y3);
+		display_draw_triangle(x1, y1, x3, y3, x4, y4);
+		return;
+	}
+
+	buffer_check_not_full(current_buffer);
+	display_push_vertex(current_buffer, x1, y1, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x2, y2, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x3, y3, r, g, b, alpha, 0, 0);
+	display_push_vertex(current_buffer, x4, y4, r, g, b, alpha, 0, 0);
+}
+
+static void display_push_triangle_color(float x1, float y1, float x2, float y2, float x3, float y3)
+{
+	display_push_quad_color(x1, y1, x2, y2, x3, y3, x3, y3);
+}
+
+/**
+ * Number of segments of a circle, so that it looks round once the camera zoom is applied.
+ * Always even, since the triangles of the fan are pushed by pairs.
+ */
+static int display_circle_segments(float r)
+{
+	float screen_r = fabsf(r) * display.camera->zoom;
+	int n = DISPLAY_CIRCLE_MIN_SEGMENTS;
+
+	if (screen_r > DISPLAY_CIRCLE_TOLERANCE) {
+		float step = 2 * acosf(1 - DISPLAY_CIRCLE_TOLERANCE / screen_r);
+		n = MAX(n, (int) ceilf(2 * (float) M_PI / step));
+	}
+	n = MIN(n, DISPLAY_CIRCLE_MAX_SEGMENTS);
+	return n + (n & 1);
+}
+
+void display_draw_circle(float cx, float cy, float r)
+{
+	r = fabsf(r);
+	if (!display_begin_shape(cx - r, cy - r, cx + r, cy + r))
+		return;
+
+	int n = display_circle_segments(r);
+	float theta = 2 * (float) M_PI / n;
+	float c = cosf(theta);
+	float s = sinf(theta);
+	float x = r;
+	float y = 0;
+
+	// two triangles of the fan make a quad: center, p0, p1, p2
+	for (int i = 0; i < n; i += 2) {
+		float x1 = c * x - s * y;
+		float y1 = s * x + c * y;
+		float x2 = c * x1 - s * y1;
+		float y2 = s * x1 + c * y1;
+		if (i + 2 == n) {
+			// close exactly the circle despite the rounding errors
+			x2 = r;
+			y2 = 0;
+		}
+		display_push_quad_color(cx, cy, cx + x, cy + y, cx + x1, cy + y1, cx + x2, cy + y2);
+		x = x2;
+		y = y2;
+	}
+}
+
+static void display_get_bbox(const float *coords, size_t n,
+                             float *xmin, float *ymin, float *xmax, float *ymax)
+{
+	*xmin = *xmax = coords[0];
+	*ymin = *ymax = coords[1];
+	for (size_t i = 1; i < n; i++) {
+		*xmin = MIN(*xmin, coords[i * 2]);
+		*xmax = MAX(*xmax, coords[i * 2]);
+		*ymin = MIN(*ymin, coords[i * 2 + 1]);
+		*ymax = MAX(*ymax, coords[i * 2 + 1]);
+	}
+}
+
+/**
+ * Copies the n points to display.shape_points (with room for n * floats_per_point floats),
+ * without consecutive identical points, which have no direction.
+ * Returns the number of points copied.
+ */
+static size_t display_copy_points(const float *coords, size_t n, bool closed, size_t floats_per_point)
+{
+	XREALLOC(display.shape_points, display.shape_points_size, n * floats_per_point);
+	float *points = display.shape_points;
+	size_t m = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		const float *p = coords + i * 2;
+		if (m && points[m * 2 - 2] == p[0] && points[m * 2 - 1] == p[1])
+			continue;
+		points[m * 2] = p[0];
+		points[m * 2 + 1] = p[1];
+		m++;
+	}
+	if (closed && m > 1 && points[0] == points[m * 2 - 2] && points[1] == points[m * 2 - 1])
+		m--;
+	return m;
+}
+
+static float display_cross(const float *o, const float *a, const float *b)
+{
+	return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+/**
+ * Tells if the vertex `i` of the remaining polygon `v` is an ear: convex, and no
+ * other vertex inside the triangle it makes with its neighbours.
+ * orientation is the sign of the area of the polygon.
+ */
+static bool display_is_ear(const float *coords, const unsigned int *v, size_t count, size_t i,
+                           float orientation)
+{
+	const float *a = coords + v[(i + count - 1) % count] * 2;
+	const float *b = coords + v[i] * 2;
+	const float *c = coords + v[(i + 1) % count] * 2;
+
+	if (display_cross(a, b, c) * orientation <= 0)
+		return false;
+
+	for (size_t j = 0; j < count; j++) {
+		const float *p = coords + v[j] * 2;
+		if (p == a || p == b || p == c)
+			continue;
+		if (display_cross(a, b, p) * orientation >= 0
+		    && display_cross(b, c, p) * orientation >= 0
+		    && display_cross(c, a, p) * orientation >= 0)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Draws the polygon of n points (x1, y1, x2, y2, ...), which may be concave.
+ * It is triangulated by ear clipping.
+ */
+void display_draw_polygon(const float *coords, size_t n)
+{
+	float xmin, ymin, xmax, ymax;
+
+	assert(coords);
+
+	n = display_copy_points(coords, n, true, 2);
+	coords = display.shape_points;
+	if (n < 3)
+		return;
+
+	display_get_bbox(coords, n, &xmin, &ymin, &xmax, &ymax);
+	if (!display_begin_shape(xmin, ymin, xmax, ymax))
+		return;
+
+	float area = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t j = (i + 1) % n;
+		area += coords[i * 2] * coords[j * 2 + 1] - coords[j * 2] * coords[i * 2 + 1];
+	}
+	float orientation = area >= 0 ? 1 : -1;
+
+	XREALLOC(display.shape_indices, display.shape_indices_size, n);
+	unsigned int *v = display.shape_indices;
+	for (size_t i = 0; i < n; i++)
+		v[i] = i;
+
+	size_t count = n;
+	size_t i = 0;
+	size_t tries = 0;
+	while (count > 3) {
+		// a complex (self intersecting) polygon may have no ear left, clip anyway
+		if (tries < count && !display_is_ear(coords, v, count, i, orientation)) {
+			i = (i + 1) % count;
+			tries++;
+			continue;
+		}
+
+		const float *a = coords + v[(i + count - 1) % count] * 2;
+		const float *b = coords + v[i] * 2;
+		const float *c = coords + v[(i + 1) % count] * 2;
+		display_push_triangle_color(a[0], a[1], b[0], b[1], c[0], c[1]);
+
+		memmove(v + i, v + i + 1, (count - i - 1) * sizeof(*v));
+		count--;
+		i %= count;
+		tries = 0;
+	}
+	display_push_triangle_color(coords[v[0] * 2], coords[v[0] * 2 + 1],
+	                            coords[v[1] * 2], coords[v[1] * 2 + 1],
+	                            coords[v[2] * 2], coords[v[2] * 2 + 1]);
+}
+
+/**
+ * Computes the points where the segments before (direction d1, normal u1) and after
+ * (d2, u2) the point p are joined, on both sides (left is p + u * hw).
+ * Returns true if the join is beveled: then in_* are the ends of the first segment,
+ * out_* are the starts of the second one.
+ */
+static bool display_join(const float *p, const float *d1, const float *u1, const float *d2, const float *u2,
+                         float hw, float in[4], float out[4])
+{
+	float mx = u1[0] + u2[0];
+	float my = u1[1] + u2[1];
+	float len = sqrtf(mx * mx + my * my);
+
+	if (len > 1e-6f) {
+		mx /= len;
+		my /= len;
+		float cos_half = mx * u2[0] + my * u2[1];
+		if (cos_half * DISPLAY_MITER_LIMIT > 1) {
+			float l = hw / cos_half;
+			in[0] = out[0] = p[0] + mx * l;
+			in[1] = out[1] = p[1] + my * l;
+			in[2] = out[2] = p[0] - mx * l;
+			in[3] = out[3] = p[1] - my * l;
+			return false;
+		}
+	}
+
+	in[0] = p[0] + u1[0] * hw;
+	in[1] = p[1] + u1[1] * hw;
+	in[2] = p[0] - u1[0] * hw;
+	in[3] = p[1] - u1[1] * hw;
+	out[0] = p[0] + u2[0] * hw;
+	out[1] = p[1] + u2[1] * hw;
+	out[2] = p[0] - u2[0] * hw;
+	out[3] = p[1] - u2[1] * hw;
+
+	// fill the gap on the outer side of the turn
+	if (d1[0] * d2[1] - d1[1] * d2[0] > 0) {
+		display_push_triangle_color(p[0], p[1], in[2], in[3], out[2], out[3]);
+	} else {
+		display_push_triangle_color(p[0], p[1], in[0], in[1], out[0], out[1]);
+	}
+	return true;
+}
+
+/**
+ * Draws the n points (x1, y1, x2, y2, ...) joined by segments of the given width.
+ * The joins are mitered, or beveled when they are too sharp.
+ */
+void display_draw_polyline(const float *coords, size_t n, bool loop, float width)
+{
+	float xmin, ymin, xmax, ymax;
+	float hw = width / 2;
+
+	assert(coords);
+
+	// room for the directions and the normals of the segments
+	size_t m = display_copy_points(coords, n, loop, 6);
+	float *points = display.shape_points;
+	if (m < 2)
+		return;
+	if (m == 2)
+		loop = false;
+
+	display_get_bbox(points, m, &xmin, &ymin, &xmax, &ymax);
+	if (!display_begin_shape(xmin - hw, ymin - hw, xmax + hw, ymax + hw))
+		return;
+
+	// direction and normal of each segment
+	size_t segments = loop ? m : m - 1;
+	float *dirs = points + m * 2;
+	float *normals = points + m * 4;
+	for (size_t k = 0; k < segments; k++) {
+		const float *a = points + k * 2;
+		const float *b = points + ((k + 1) % m) * 2;
+		float dx = b[0] - a[0];
+		float dy = b[1] - a[1];
+		float len = sqrtf(dx * dx + dy * dy);
+		dirs[k * 2] = dx / len;
+		dirs[k * 2 + 1] = dy / len;
+		normals[k * 2] = -dirs[k * 2 + 1];
+		normals[k * 2 + 1] = dirs[k * 2];
+	}
+
+	float start[4];
+	float end[4];
+	// end of the last segment, for loops
+	float last_end[4];
+	if (loop) {
+		display_join(points, dirs + (segments - 1) * 2, normals + (segments - 1) * 2,
+		             dirs, normals, hw, last_end, start);
+	} else {
+		start[0] = points[0] + normals[0] * hw;
+		start[1] = points[1] + normals[1] * hw;
+		start[2] = points[0] - normals[0] * hw;
+		start[3] = points[1] - normals[1] * hw;
+	}
+
+	for (size_t k = 0; k < segments; k++) {
+		size_t next = (k + 1) % m;
+		const float *p = points + next * 2;
+		float next_start[4];
+
+		if (k + 1 < segments) {
+			display_join(p, dirs + k * 2, normals + k * 2, dirs + k * 2 + 2, normals + k * 2 + 2,
+			             hw, end, next_start);
+		} else if (loop) {
+			memcpy(end, last_end, sizeof(end));
+		} else {
+			end[0] = p[0] + normals[k * 2] * hw;
+			end[1] = p[1] + normals[k * 2 + 1] * hw;
+			end[2] = p[0] - normals[k * 2] * hw;
+			end[3] = p[1] - normals[k * 2 + 1] * hw;
+		}
+
+		display_push_quad_color(start[0], start[1], end[0], end[1],
+		                        end[2], end[3], start[2], start[3]);
+		if (k + 1 < segments)
+			memcpy(start, next_start, sizeof(start));
+	}
+}
+
+void display_draw_square(float x, float y, float w, float h, float width)
+{
+	const float corners[] = {x, y, x + w, y, x + w, y + h, x, y + h};
+
+	display_draw_polyline(corners, 4, true, width);
+}
+
+/**
+ * Clips the convex polygon 'in' of 'n' points to the side of the line 'axis' = 'limit'
+ * (axis is 0 for x, 1 for y) where (coordinate - limit) * sign is positive.
+ * 'out' receives at most n + 1 points.
+ */
+static unsigned int display_clip_polygon(const float *in, unsigned int n, float *out,
+                                         int axis, float limit, float sign)
+{
+	unsigned int m = 0;
+
+	for (unsigned int i = 0; i < n; i++) {
+		const float *a = in + i * 2;
+		const float *b = in + ((i + 1) % n) * 2;
+		float da = (a[axis] - limit) * sign;
+		float db = (b[axis] - limit) * sign;
+
+		if (da >= 0) {
+			out[m * 2] = a[0];
+			out[m * 2 + 1] = a[1];
+			m++;
+		}
+		if ((da >= 0) != (db >= 0)) {
+			float t = da / (da - db);
+			out[m * 2] = a[0] + (b[0] - a[0]) * t;
+			out[m * 2 + 1] = a[1] + (b[1] - a[1]) * t;
+			m++;
+		}
+	}
+	return m;
+}
+
+/**
+ * Draws the triangle 'src' of the current grid surface at 'dst'.
+ * The triangle is clipped to each cell it overlaps, and the pieces are
+ * drawn with the texture of their cell, unless they are culled.
+ */
+static void display_draw_grid_triangle(const float *src, const float *dst)
+{
+	Surface *grid = display.current_from;
+	Buffer *current_buffer = display.current_buffer;
+	unsigned char r = display.r;
+	unsigned char g = display.g;
+	unsigned char b = display.b;
+	unsigned char alpha = display.alpha;
+
+	// the cells cannot be recorded in a single user buffer, the bindings refuse it
+	if (current_buffer->user_buffer)
+		return;
+
+	float ux = src[2] - src[0];
+	float uy = src[3] - src[1];
+	float vx = src[4] - src[0];
+	float vy = src[5] - src[1];
+	float det = ux * vy - uy * vx;
+	if (det == 0)
+		return;
+
+	float size = grid->grid_cell_size;
+	float xmin = MIN(src[0], MIN(src[2], src[4]));
+	float xmax = MAX(src[0], MAX(src[2], src[4]));
+	float ymin = MIN(src[1], MIN(src[3], src[5]));
+	float ymax = MAX(src[1], MAX(src[3], src[5]));
+	int column0 = MAX((int) floorf(xmin / size), 0);
+	int column1 = MIN((int) ceilf(xmax / size), (int) grid->grid_columns);
+	int row0 = MAX((int) floorf(ymin / size), 0);
+	int row1 = MIN((int) ceilf(ymax / size), (int) grid->grid_rows);
+
+	for (int row = row0; row < row1; row++) {
+		for (int column = column0; column < column1; column++) {
+			Surface *cell = grid->grid[column + row * grid->grid_columns];
+			float x0 = column * size;
+			float y0 = row * size;
+			float poly[16];
+			float tmp[16];
+			float out[16];
+			unsigned int n;
+
+			n = display_clip_polygon(src, 3, tmp, 0, x0, 1);
+			n = display_clip_polygon(tmp, n, poly, 0, x0 + cell->w, -1);
+			n = display_clip_polygon(poly, n, tmp, 1, y0, 1);
+			n = display_clip_polygon(tmp, n, poly, 1, y0 + cell->h, -1);
+			if (n < 3)
+				continue;
+
+			// the destination of a point is found from its barycentric coordinates in 'src'
+			for (unsigned int i = 0; i < n; i++) {
+				float dx = poly[i * 2] - src[0];
+				float dy = poly[i * 2 + 1] - src[1];
+				float u = (dx * vy - dy * vx) / det;
+				float v = (ux * dy - uy * dx) / det;
+				out[i * 2] = dst[0] + u * (dst[2] - dst[0]) + v * (dst[4] - dst[0]);
+				out[i * 2 + 1] = dst[1] + u * (dst[3] - dst[1]) + v * (dst[5] - dst[1]);
+			}
+			if (display_cull(out, n))
+				continue;
+
+			display_draw_from_cell(cell);
+			buffer_check_use_texture(current_buffer);
+
+			// the polygon is a fan, and so are the quads of the buffer
+			for (unsigned int i = 1; i + 1 < n; i += 2) {
+				unsigned int idx[4] = {0, i, i + 1, MIN(i + 2, n - 1)};
+				buffer_check_not_full(current_buffer);
+				for (int k = 0; k < 4; k++) {
+					unsigned int j = idx[k];
+					display_push_vertex(current_buffer, out[j * 2], out[j * 2 + 1], r, g, b, alpha,
+					                   poly[j * 2] - x0, poly[j * 2 + 1] - y0);
+				}
+			}
+		}
+	}
 }
 
 void display_draw_surface(float xi1, float yi1, float xi2, float yi2, float xi3, float yi3,
@@ -662,7 +1794,6 @@ void display_draw_surface(float xi1, float yi1, float xi2, float yi2, float xi3,
 	unsigned char g = display.g;
 	unsigned char b = display.b;
 	unsigned char alpha = display.alpha;
-	int i;
 
 	if (display.debug_mode && !current_buffer->user_buffer) {
 		display.debug_mode = false;
@@ -675,62 +1806,102 @@ void display_draw_surface(float xi1, float yi1, float xi2, float yi2, float xi3,
 
 	assert(display.current_from);
 
-	buffer_check_use_texture(current_buffer);
-	buffer_check_not_full(current_buffer);
+	if (display.current_from->grid) {
+		const float src[] = {xi1, yi1, xi2, yi2, xi3, yi3};
+		const float dst[] = {xo1, yo1, xo2, yo2, xo3, yo3};
+		display_draw_grid_triangle(src, dst);
+		return;
+	}
 
-	buffer_push_tex_coord(current_buffer, xi1, yi1);
-	buffer_push_tex_coord(current_buffer, xi2, yi2);
-	buffer_push_tex_coord(current_buffer, xi3, yi3);
+	// position of the surface in its atlas page (0 if not packed)
+	float ox = display.current_from->page_x;
+	float oy = display.current_from->page_y;
 
-	buffer_push_vertex(current_buffer, xo1, yo1);
-	buffer_push_vertex(current_buffer, xo2, yo2);
-	buffer_push_vertex(current_buffer, xo3, yo3);
+	const float vertices[] = {xo1, yo1, xo2, yo2, xo3, yo3};
+	if (display_cull(vertices, 3))
+		return;
+
+	buffer_check_use_texture(current_buffer);
+	buffer_check_not_full(current_buffer);
 
-	for (i = 0; i < 3; i++)
-		buffer_push_color(current_buffer, r, g, b, alpha);
+	display_push_vertex(current_buffer, xo1, yo1, r, g, b, alpha, xi1 + ox, yi1 + oy);
+	display_push_vertex(current_buffer, xo2, yo2, r, g, b, alpha, xi2 + ox, yi2 + oy);
+	display_push_vertex(current_buffer, xo3, yo3, r, g, b, alpha, xi3 + ox, yi3 + oy);
+	display_push_vertex(current_buffer, xo3, yo3, r, g, b, alpha, xi3 + ox, yi3 + oy);
 }
 
 void display_draw_quad(float xi1, float yi1, float xi2, float yi2, float xi3, float yi3, float xi4, float yi4,
                        float xo1, float yo1, float xo2, float yo2, float xo3, float yo3, float xo4, float yo4)
 {
-	display_draw_surface(xi1, yi1, xi2, yi2, xi3, yi3, xo1, yo1, xo2, yo2, xo3, yo3);
-	display_draw_surface(xi1, yi1, xi3, yi3, xi4, yi4, xo1, yo1, xo3, yo3, xo4, yo4);
-}
+	Buffer *current_buffer = display.current_buffer;
+	unsigned char r = display.r;
+	unsigned char g = display.g;
+	unsigned char b = display.b;
+	unsigned char alpha = display.alpha;
+
+	if (display.debug_mode && !current_buffer->user_buffer) {
+		display_draw_surface(xi1, yi1, xi2, yi2, xi3, yi3, xo1, yo1, xo2, yo2, xo3, yo3);
+		display_draw_surface(xi1, yi1, xi3, yi3, xi4, yi4, xo1, yo1, xo3, yo3, xo4, yo4);
+		return;
+	}
+
+	assert(display.current_from);
+
+	if (display.current_from->grid) {
+		display_draw_surface(xi1, yi1, xi2, yi2, xi3, yi3, xo1, yo1, xo2, yo2, xo3, yo3);
+		display_draw_surface(xi1, yi1, xi3, yi3, xi4, yi4, xo1, yo1, xo3, yo3, xo4, yo4);
+		return;
+	}
+
+	float ox = display.current_from->page_x;
+	float oy = display.current_from->page_y;
+
+	const float vertices[] = {xo1, yo1, xo2, yo2, xo3, yo3, xo4, yo4};
+	if (display_cull(vertices, 4))
+		return;
+
+	buffer_check_use_texture(current_buffer);
+	buffer_check_not_full(current_buffer);
 
+	display_push_vertex(current_buffer, xo1, yo1, r, g, b, alpha, xi1 + ox, yi1 + oy);
+	display_push_vertex(current_buffer, xo2, yo2, r, g, b, alpha, xi2 + ox, yi2 + oy);
+	display_push_vertex(current_buffer, xo3, yo3, r, g, b, alpha, xi3 + ox, yi3 + oy);
+	display_push_vertex(current_buffer, xo4, yo4, r, g, b, alpha, xi4 + ox, yi4 + oy);
+}
 
 /**
- * Shader
+ * Draws the part (xi, yi, wi, hi) of the current surface in the rectangle (x, y, w, h),
+ * rotated by angle around (x + hx, y + hy).
+ * A negative wi or hi flips the sprite.
  */
-static char* getShaderError(GLuint obj)
+void display_draw_sprite(float xi, float yi, float wi, float hi,
+                         float x, float y, float w, float h,
+                         float angle, float hx, float hy)
 {
-	int length;
+	float xi2 = xi + wi;
+	float yi2 = yi + hi;
 
-	if (glIsShader(obj)) {
-		glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &length);
-	} else {
-		glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &length);
+	if (angle == 0) {
+		display_draw_quad(xi, yi, xi2, yi, xi2, yi2, xi, yi2,
+		                  x, y, x + w, y, x + w, y + h, x, y + h);
+		return;
 	}
 
-	char* error = NULL;
-	if (length > 1) { // make sure the error is explained here
-		error = new(char, length);
+	float o[8];
 
-		if (glIsShader(obj))
-			glGetShaderInfoLog(obj, length, NULL, error);
-		else
-			glGetProgramInfoLog(obj, length, NULL, error);
-	}
-
-	return error;
+	display_rotate_rect(x, y, w, h, angle, hx, hy, o);
+	display_draw_quad(xi, yi, xi2, yi, xi2, yi2, xi, yi2,
+	                  o[0], o[1], o[2], o[3], o[4], o[5], o[6], o[7]);
 }
 
+
+/**
+ * Shader
+ */
 Shader * display_new_shader(const char* strvert, const char* strfragcolor, const char* strfragtex, char** error)
 {
-	GLuint vert = 0;
-	GLuint frag_color = 0;
-	GLuint frag_tex = 0;
-	GLuint prog_color;
-	GLuint prog_tex;
+	ShaderProgram *program_color;
+	ShaderProgram *program_tex;
 
 	if (!strvert || !*strvert) {
 		strvert = DEFAULT_VERTEX_SHADER;
@@ -746,85 +1917,25 @@ Shader * display_new_shader(const char* strvert, const char* strfragcolor, const
 	assert(strfragcolor);
 	assert(strvert);
 
-	const char* new_strvert[] = {
-		SHADER_PREFIX,
-		strvert
-	};
-	const char* new_strfragcolor[] = {
-		SHADER_PREFIX,
-		strfragcolor
-	};
-	const char* new_strfragtex[] = {
-		SHADER_PREFIX,
-		strfragtex
-	};
-
-	vert = glCreateShader(GL_VERTEX_SHADER);
-	assert(vert);
-	glShaderSource(vert, 2, new_strvert, NULL);
-	glCompileShader(vert);
-
-	frag_color = glCreateShader(GL_FRAGMENT_SHADER);
-	assert(frag_color);
-	glShaderSource(frag_color, 2, new_strfragcolor, NULL);
-	glCompileShader(frag_color);
-
-	frag_tex = glCreateShader(GL_FRAGMENT_SHADER);
-	assert(frag_tex);
-	glShaderSource(frag_tex, 2, new_strfragtex, NULL);
-	glCompileShader(frag_tex);
-
-	prog_color = glCreateProgram();
-	assert(prog_color);
-	glBindAttribLocation(prog_color, ATTR_LOCATION_POSITION, "position");
-	glBindAttribLocation(prog_color, ATTR_LOCATION_COLOR, "color");
-	glBindAttribLocation(prog_color, ATTR_LOCATION_TEXCOORD, "texCoord");
-	glAttachShader(prog_color, vert);
-	glAttachShader(prog_color, frag_color);
-	glLinkProgram(prog_color);
-
-	prog_tex = glCreateProgram();
-	assert(prog_tex);
-	glBindAttribLocation(prog_tex, ATTR_LOCATION_POSITION, "position");
-	glBindAttribLocation(prog_tex, ATTR_LOCATION_COLOR, "color");
-	glBindAttribLocation(prog_tex, ATTR_LOCATION_TEXCOORD, "texCoord");
-	glAttachShader(prog_tex, vert);
-	glAttachShader(prog_tex, frag_tex);
-	glLinkProgram(prog_tex);
-
-	GLint status;
-	glGetProgramiv(prog_color, GL_LINK_STATUS, &status);
-	if (status != GL_TRUE) {
-		if (error) {
-			*error = getShaderError(vert);
-			if (!*error)
-				*error = getShaderError(frag_color);
-			if (!*error)
-				*error = getShaderError(prog_color);
-		}
+	program_color = shader_program_get(strvert, strfragcolor, error);
+	if (!program_color)
 		return NULL;
-	}
 
-	glGetProgramiv(prog_tex, GL_LINK_STATUS, &status);
-	if (status != GL_TRUE) {
-		if (error) {
-			*error = getShaderError(vert);
-			if (!*error)
-				*error = getShaderError(frag_tex);
-			if (!*error)
-				*error = getShaderError(prog_tex);
-		}
+	program_tex = shader_program_get(strvert, strfragtex, error);
+	if (!program_tex) {
+		shader_program_release(program_color);
 		return NULL;
 	}
 
-	return shader_new(prog_color, prog_tex, vert, frag_color, frag_tex);
+	return shader_new(program_color, program_tex);
 }
 
 void display_use_shader(Shader* shader)
 {
 	assert(shader);
 
-	buffer_check_empty(display.current_buffer);
+	buffer_check_empty(display.current_buffer, FLUSH_SHADER);
+	display_check_batches();
 
 	display.current_shader = shader;
 	buffer_use_shader(display.current_buffer, shader);
@@ -835,11 +1946,27 @@ void display_use_default_shader()
 	display_use_shader(display.default_shader);
 }
 
+Shader *display_get_shader()
+{
+	return display.current_shader;
+}
+
+int display_feed_shader(Shader *shader, const char *name, const float *values, unsigned int count)
+{
+	assert(shader);
+	assert(name);
+
+	// recorded batches have to be drawn with the previous value
+	display_flush_batches();
+	return shader_feed(shader, name, values, count);
+}
+
 void display_free_shader(Shader *shader)
 {
 	if (!shader)
 		return;
 
+	display_flush_batches();
 	if (shader == display.current_shader) {
 		display_use_default_shader();
 	}
@@ -863,7 +1990,7 @@ void display_use_buffer(Buffer* buffer)
 	display.current_buffer = buffer;
 	buffer_use_shader(buffer, display.current_shader);
 	buffer->draw_on = display.current_on;
-	buffer->draw_from = display.current_from;
+	buffer->draw_from = display_get_texture(display.current_from);
 }
 
 void display_use_default_buffer()
@@ -875,10 +2002,71 @@ void display_draw_buffer(Buffer* buffer, float dx, float dy)
 {
 	assert(buffer);
 
-	buffer_check_empty(display.current_buffer);
+	buffer_check_empty(display.current_buffer, FLUSH_OTHER);
+	display_flush_batches();
 	buffer->draw_on = display.current_on;
-	buffer->draw_from = display.current_from;
+	buffer->draw_from = display_get_texture(display.current_from);
 	buffer_draw(buffer, dx, dy);
+	if (display.current_on)
+		surface_mark_all_stale(display.current_on);
+}
+
+/**
+ * Draws the chunks of the tilemap visible through the camera, with its top-left corner at (x, y).
+ */
+void display_draw_tilemap(Tilemap *tilemap, float x, float y)
+{
+	assert(tilemap);
+	assert(display.current_on);
+
+	Surface *old_from = display.current_from;
+	float chunk_w = tilemap->tile_w * TILEMAP_CHUNK_SIZE;
+	float chunk_h = tilemap->tile_h * TILEMAP_CHUNK_SIZE;
+	int cx0 = 0, cy0 = 0;
+	int cx1 = tilemap->chunks_x;
+	int cy1 = tilemap->chunks_y;
+
+	buffer_check_empty(display.current_buffer, FLUSH_OTHER);
+	display_flush_batches();
+	display_draw_from(tilemap->tileset);
+
+	if (display.cull_dirty)
+		display_update_cull_region();
+	if (display.cull_xmin > -INFINITY) {
+		cx0 = MAX(cx0, (int) floorf((display.cull_xmin - x) / chunk_w));
+		cy0 = MAX(cy0, (int) floorf((display.cull_ymin - y) / chunk_h));
+		cx1 = MIN(cx1, (int) floorf((display.cull_xmax - x) / chunk_w) + 1);
+		cy1 = MIN(cy1, (int) floorf((display.cull_ymax - y) / chunk_h) + 1);
+	}
+
+	for (int cy = cy0; cy < cy1; cy++) {
+		for (int cx = cx0; cx < cx1; cx++) {
+			Buffer *buffer = tilemap_get_chunk(tilemap, cx, cy);
+			if (!buffer)
+				continue;
+
+			buffer_use_shader(buffer, display.current_shader);
+			buffer_use_camera(buffer, display.camera);
+			buffer->draw_on = display.current_on;
+			buffer->draw_from = display_get_texture(tilemap->tileset);
+			buffer->color[0] = display.r;
+			buffer->color[1] = display.g;
+			buffer->color[2] = display.b;
+			buffer->color[3] = display.alpha;
+			buffer_draw(buffer, x, y);
+			display.stats.submitted++;
+		}
+	}
+	if (cx0 < cx1 && cy0 < cy1) {
+		unsigned int drawn = (cx1 - cx0) * (cy1 - cy0);
+		display.stats.culled += tilemap->chunks_x * tilemap->chunks_y - drawn;
+		if (display.current_on->pixels)
+			display_mark_drawn(x + cx0 * chunk_w, y + cy0 * chunk_h, x + cx1 * chunk_w, y + cy1 * chunk_h);
+	} else {
+		display.stats.culled += tilemap->chunks_x * tilemap->chunks_y;
+	}
+
+	display_draw_from(old_from);
 }
 
 Buffer *display_get_current_buffer(void)
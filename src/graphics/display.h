@@ -29,6 +29,7 @@
 #include "surface.h"
 #include "camera.h"
 #include "shader.h"
+#include "tilemap.h"
 
 typedef struct SDL_Surface SDL_Surface;
 typedef struct SDL_Window SDL_Window;
@@ -41,7 +42,15 @@ enum BlendMode {
 };
 typedef enum BlendMode BlendMode;
 
-int display_init(void);
+typedef struct DisplayStats DisplayStats;
+
+struct DisplayStats {
+	unsigned int texture_binds;
+	unsigned int culled;
+	unsigned int submitted;
+};
+
+int display_init(bool headless);
 void display_free(void);
 
 void display_set_title(const char *title);
@@ -58,9 +67,20 @@ void display_get_color(int *red, int *green, int *blue);
 void display_get_alpha(int *a);
 
 void display_set_blend_mode(BlendMode mode);
+void display_set_deferred(bool deferred);
+bool display_is_deferred(void);
+void display_flush_batches(void);
+void display_set_direct_rendering(bool direct);
+void display_leave_direct_rendering(void);
+void display_set_culling(bool culling);
+const DisplayStats *display_get_stats(void);
 void display_set_filter(Surface* surface, FilterMode mode);
 void display_get_pixel(Surface* surface, unsigned int x, unsigned int y,
 		       int* red, int* green, int* blue, int* alpha);
+void display_get_pixels(Surface* surface, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+                        unsigned char *pixels);
+void display_lock_surface(Surface* surface);
+void display_unlock_surface(Surface* surface);
 
 Camera *display_get_camera(void);
 void display_reset_camera(void);
@@ -69,11 +89,14 @@ void display_pop_camera(void);
 void display_set_camera_position(float dx, float dy);
 void display_set_camera_angle(float angle);
 void display_set_camera_zoom(float zoom);
+void display_set_cpu_camera(bool cpu_camera);
+bool display_is_cpu_camera(void);
 
 Surface* display_get_screen(void);
 Surface* display_create_surface(unsigned int w, unsigned int h, unsigned int texw, unsigned int texh, unsigned char* pixels);
 Surface* display_new_surface(int w, int h, bool force_npot);
-int display_load_surface(const char *filename, Surface **surface);
+int display_load_surface(const char *filename, Surface **surface, bool atlas);
+Surface *display_upload_surface(const char *filename, const SurfaceImage *image, bool atlas);
 void display_free_surface(Surface *surface);
 
 void display_draw_on(Surface *surface);
@@ -86,13 +109,24 @@ void display_draw_point(float x, float y, float size);
 void display_draw_point_tex(float sx, float sy, float x, float y, float size);
 void display_draw_line(float x1, float y1, float x2, float y2, float width);
 void display_draw_triangle(float x1, float y1, float x2, float y2, float x3, float y3);
+void display_draw_rect(float x, float y, float w, float h);
+void display_draw_rect_rotated(float x, float y, float w, float h, float angle, float hx, float hy);
+void display_draw_circle(float cx, float cy, float r);
+void display_draw_polygon(const float *coords, size_t n);
+void display_draw_polyline(const float *coords, size_t n, bool loop, float width);
+void display_draw_square(float x, float y, float w, float h, float width);
 void display_draw_surface(float, float, float, float, float, float, float, float, float, float, float, float);
 void display_draw_quad(float xi1, float yi1, float xi2, float yi2, float xi3, float yi3, float xi4, float yi4,
                        float xo1, float yo1, float xo2, float yo2, float xo3, float yo3, float xo4, float yo4);
+void display_draw_sprite(float xi, float yi, float wi, float hi,
+                         float x, float y, float w, float h,
+                         float angle, float hx, float hy);
 
 Shader* display_new_shader(const char* strvert, const char* strfragcolor, const char* strfragtex, char** error);
 void display_use_shader(Shader *shader);
 void display_use_default_shader(void);
+Shader *display_get_shader(void);
+int display_feed_shader(Shader *shader, const char *name, const float *values, unsigned int count);
 void display_free_shader(Shader *shader);
 
 Buffer* display_new_buffer(unsigned int size);
@@ -103,6 +137,7 @@ static inline Buffer* display_new_auto_buffer(void)
 void display_use_buffer(Buffer *buffer);
 void display_use_default_buffer(void);
 void display_draw_buffer(Buffer *buffer, float dx, float dy);
+void display_draw_tilemap(Tilemap *tilemap, float x, float y);
 Buffer *display_get_current_buffer(void);
 void display_free_buffer(Buffer* buffer);
 
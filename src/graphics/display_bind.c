@@ -16,12 +16,18 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <math.h>
+#include <stdint.h>
 #include <lua.h>
 #include <lauxlib.h>
 
 #include "display.h"
 #include "buffer.h"
 #include "display_bind.h"
+#include "loader.h"
+#include "texture_cache.h"
+#include "float_array_bind.h"
+#include "pixel_array_bind.h"
 #include "lua_util.h"
 #include "dlua.h"
 #include "log.h"
@@ -101,6 +107,50 @@ int mlua_set_blend_mode(lua_State* L)
 	return 0;
 }
 
+int mlua_set_deferred(lua_State* L)
+{
+	assert(L);
+
+	bool deferred = lua_toboolean(L, 1);
+	display_set_deferred(deferred);
+	return 0;
+}
+
+int mlua_set_direct_rendering(lua_State* L)
+{
+	assert(L);
+
+	bool direct = lua_toboolean(L, 1);
+	display_set_direct_rendering(direct);
+	return 0;
+}
+
+int mlua_set_culling(lua_State* L)
+{
+	assert(L);
+
+	bool culling = lua_toboolean(L, 1);
+	display_set_culling(culling);
+	return 0;
+}
+
+int mlua_set_cpu_camera(lua_State* L)
+{
+	assert(L);
+
+	bool cpu_camera = lua_toboolean(L, 1);
+	display_set_cpu_camera(cpu_camera);
+	return 0;
+}
+
+int mlua_flush(lua_State* L)
+{
+	assert(L);
+
+	display_flush_batches();
+	return 0;
+}
+
 int mlua_show_cursor(lua_State* L)
 {
 	assert(L);
@@ -158,6 +208,25 @@ int mlua_surface_class_index(lua_State* L)
 	return 1;
 }
 
+void push_load_surface_error(lua_State* L, const char *name, int r)
+{
+	assert(L);
+	assert(name);
+	assert(r < 0);
+
+	lua_pushnil(L);
+	if (r == -E2BIG) {
+		lua_pushfstring(L, "%s: surface size must be width > 0 and <= %d, height > 0 and <= %d",
+		                name, SURFACE_MAX_IMAGE_SIZE, SURFACE_MAX_IMAGE_SIZE);
+	} else if (r == -ENOTSUP) {
+		lua_pushfstring(L, "%s: unsupported format", name);
+	} else if (r == -EBADMSG) {
+		lua_pushfstring(L, "%s: not a PNG", name);
+	} else {
+		lua_pushfstring(L, "%s: %s", name, strerror(-r));
+	}
+}
+
 int mlua_load_surface(lua_State* L)
 {
 	assert(L);
@@ -165,24 +234,41 @@ int mlua_load_surface(lua_State* L)
 	int r;
 	Surface *surface;
 	const char * filename = luaL_checkstring(L, 1);
-	r = display_load_surface(filename, &surface);
+	bool atlas = lua_toboolean(L, 2);
+	r = display_load_surface(filename, &surface, atlas);
 	if (r < 0) {
-		lua_pushnil(L);
-		if (r == -E2BIG) {
-			lua_pushliteral(L, "load_surface: surface size must be width > 0 and <= 2048, height > 0 and <= 2048");
-		} else if (r == -ENOTSUP) {
-			lua_pushliteral(L, "load_surface: unsupported format");
-		} else if (r == -EBADMSG) {
-			lua_pushliteral(L, "load_surface: not a PNG");
-		} else {
-			lua_pushfstring(L, "%s: %s", "load_surface", strerror(errno));
-		}
+		push_load_surface_error(L, "load_surface", r);
 		return 2;
 	}
 	push_surface(L, surface);
 	return 1;
 }
 
+int mlua_load_surface_async(lua_State* L)
+{
+	assert(L);
+
+	const char * filename = luaL_checkstring(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	bool atlas = lua_toboolean(L, 3);
+
+	lua_pushvalue(L, 2);
+	int callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	loader_push(filename, atlas, callback_ref);
+	return 0;
+}
+
+int mlua_set_texture_cache(lua_State* L)
+{
+	assert(L);
+
+	const char *directory = lua_isnoneornil(L, 1) ? NULL : luaL_checkstring(L, 1);
+	int r = texture_cache_set_directory(directory);
+	if (r < 0)
+		return luaL_error(L, "set_texture_cache: cannot create '%s': %s", directory, strerror(-r));
+	return 0;
+}
+
 int mlua_new_surface(lua_State* L)
 {
 	assert(L);
@@ -214,6 +300,9 @@ int mlua_draw_on_surface(lua_State* L)
 
 	Surface* old = display_get_draw_on();
 	Surface* surface = pop_surface(L, 1);
+	assert_lua_error(L, !surface->page, "draw_on: cannot draw on a surface packed in an atlas");
+	assert_lua_error(L, !surface->locked, "draw_on: cannot draw on a locked surface");
+	assert_lua_error(L, !surface->grid, "draw_on: cannot draw on a surface split in several textures");
 	display_draw_on(surface);
 
 	if (old) {
@@ -277,6 +366,54 @@ int mlua_get_pixel_surface(lua_State* L)
 	return 4;
 }
 
+int mlua_get_pixels_surface(lua_State* L)
+{
+	assert(L);
+
+	Surface* surface = pop_surface(L, 1);
+	lua_Integer x = luaL_checkinteger(L, 2);
+	lua_Integer y = luaL_checkinteger(L, 3);
+	lua_Integer w = luaL_checkinteger(L, 4);
+	lua_Integer h = luaL_checkinteger(L, 5);
+	assert_lua_error(L, surface != display_get_draw_on(), "get_pixels: the surface is currently drawn on");
+	assert_lua_error(L, x >= 1, "get_pixels: x must be greater or equal to 1");
+	assert_lua_error(L, y >= 1, "get_pixels: y must be greater or equal to 1");
+	assert_lua_error(L, w >= 1, "get_pixels: w must be greater or equal to 1");
+	assert_lua_error(L, h >= 1, "get_pixels: h must be greater or equal to 1");
+	assert_lua_error(L, (unsigned int) (x + w - 1) <= surface->w, "get_pixels: the rectangle must be inside the surface");
+	assert_lua_error(L, (unsigned int) (y + h - 1) <= surface->h, "get_pixels: the rectangle must be inside the surface");
+
+	PixelArray *pixels = pixel_array_new(L, w, h);
+	display_get_pixels(surface, x - 1, y - 1, w, h, pixels->values);
+	return 1;
+}
+
+int mlua_lock_surface(lua_State* L)
+{
+	assert(L);
+
+	Surface* surface = pop_surface(L, 1);
+	assert_lua_error(L, !surface->locked, "lock: the surface is already locked");
+	assert_lua_error(L, !surface->page, "lock: cannot lock a surface packed in an atlas");
+	assert_lua_error(L, !surface->grid, "lock: cannot lock a surface split in several textures");
+	assert_lua_error(L, surface != display_get_draw_on(), "lock: the surface is currently drawn on");
+
+	display_lock_surface(surface);
+	pixel_array_new_view(L, 1, surface);
+	return 1;
+}
+
+int mlua_unlock_surface(lua_State* L)
+{
+	assert(L);
+
+	Surface* surface = pop_surface(L, 1);
+	assert_lua_error(L, surface->locked, "unlock: the surface is not locked");
+
+	display_unlock_surface(surface);
+	return 0;
+}
+
 int mlua_draw_background(_unused_ lua_State *L)
 {
 	display_draw_background();
@@ -307,6 +444,8 @@ int mlua_draw_point_tex(lua_State* L)
 	Buffer* buffer = display_get_current_buffer();
 	assert_lua_error(L, !buffer->user_buffer || buffer_is_empty(buffer) || buffer->has_texture,
 					 "draw_point_tex: the current buffer cannot contain textured points");
+	assert_lua_error(L, !buffer->user_buffer || !display_get_draw_from()->grid,
+					 "draw_point_tex: a surface split in several textures cannot be drawn in a user buffer");
 
 	lua_Number sx = luaL_checknumber(L, 1);
 	lua_Number sy = luaL_checknumber(L, 2);
@@ -353,6 +492,22 @@ int mlua_draw_triangle(lua_State* L)
 	return 0;
 }
 
+int mlua_draw_rect(lua_State* L)
+{
+	assert(L);
+
+	Buffer* buffer = display_get_current_buffer();
+	assert_lua_error(L, !buffer->user_buffer || buffer_is_empty(buffer) || !buffer->has_texture,
+					 "draw_rect: the current buffer cannot contain non textured triangles");
+
+	lua_Number x = luaL_checknumber(L, 1);
+	lua_Number y = luaL_checknumber(L, 2);
+	lua_Number w = luaL_checknumber(L, 3);
+	lua_Number h = luaL_checknumber(L, 4);
+	display_draw_rect(x, y, w, h);
+	return 0;
+}
+
 int mlua_draw_surface(lua_State* L)
 {
 	assert(L);
@@ -362,6 +517,8 @@ int mlua_draw_surface(lua_State* L)
 	Buffer* buffer = display_get_current_buffer();
 	assert_lua_error(L, !buffer->user_buffer || buffer_is_empty(buffer) || buffer->has_texture,
 					 "draw_surface: the current buffer cannot contain textured triangles");
+	assert_lua_error(L, !buffer->user_buffer || !display_get_draw_from()->grid,
+					 "draw_surface: a surface split in several textures cannot be drawn in a user buffer");
 
 	lua_Number i1 = luaL_checknumber(L, 1);
 	lua_Number i2 = luaL_checknumber(L, 2);
@@ -389,6 +546,8 @@ int mlua_draw_quad(lua_State* L)
 	Buffer* buffer = display_get_current_buffer();
 	assert_lua_error(L, !buffer->user_buffer || buffer_is_empty(buffer) || buffer->has_texture,
 					 "draw_quad: the current buffer cannot contain textured triangles");
+	assert_lua_error(L, !buffer->user_buffer || !display_get_draw_from()->grid,
+					 "draw_quad: a surface split in several textures cannot be drawn in a user buffer");
 
 	lua_Number i1 = luaL_checknumber(L, 1);
 	lua_Number i2 = luaL_checknumber(L, 2);
@@ -411,3 +570,352 @@ int mlua_draw_quad(lua_State* L)
 	return 0;
 }
 
+
+static void get_sprite(lua_State* L, int index, const char *func, float *x, float *y, float *w, float *h)
+{
+	luaL_checktype(L, index, LUA_TTABLE);
+	lua_getfield(L, index, "x");
+	lua_getfield(L, index, "y");
+	lua_getfield(L, index, "w");
+	lua_getfield(L, index, "h");
+	if (!lua_isnumber(L, -4) || !lua_isnumber(L, -3) || !lua_isnumber(L, -2) || !lua_isnumber(L, -1))
+		luaL_error(L, "%s: the sprite must have the fields x, y, w and h", func);
+	*x = lua_tonumber(L, -4);
+	*y = lua_tonumber(L, -3);
+	*w = lua_tonumber(L, -2);
+	*h = lua_tonumber(L, -1);
+	lua_pop(L, 4);
+}
+
+static void check_textured_draw(lua_State* L, const char *func, Surface *surface)
+{
+	if (!surface && !display_get_draw_from())
+		luaL_error(L, "%s: no 'drawn from' surface bound", func);
+
+	Buffer* buffer = display_get_current_buffer();
+	if (buffer->user_buffer && !buffer_is_empty(buffer) && !buffer->has_texture)
+		luaL_error(L, "%s: the current buffer cannot contain textured triangles", func);
+
+	Surface *from = surface ? surface : display_get_draw_from();
+	if (buffer->user_buffer && from->grid)
+		luaL_error(L, "%s: a surface split in several textures cannot be drawn in a user buffer", func);
+}
+
+int mlua_draw_sprite_simple(lua_State* L)
+{
+	assert(L);
+
+	float xi, yi, wi, hi;
+	get_sprite(L, 1, "draw_sprite_simple", &xi, &yi, &wi, &hi);
+	lua_Number x = luaL_checknumber(L, 2);
+	lua_Number y = luaL_checknumber(L, 3);
+	check_textured_draw(L, "draw_sprite_simple", NULL);
+
+	display_draw_sprite(xi, yi, wi, hi, x, y, wi, hi, 0, 0, 0);
+	return 0;
+}
+
+/**
+ * draw_sprite(sprite, x, y[, transform[, hx, hy]])
+ * transform has the fields angle, wfactor and hfactor (negative to flip)
+ * the sprite is rotated around (x + hx, y + hy), its center by default
+ */
+int mlua_draw_sprite(lua_State* L)
+{
+	assert(L);
+
+	float xi, yi, wi, hi;
+	get_sprite(L, 1, "draw_sprite", &xi, &yi, &wi, &hi);
+	lua_Number x = luaL_checknumber(L, 2);
+	lua_Number y = luaL_checknumber(L, 3);
+	check_textured_draw(L, "draw_sprite", NULL);
+
+	if (lua_isnoneornil(L, 4)) {
+		display_draw_sprite(xi, yi, wi, hi, x, y, wi, hi, 0, 0, 0);
+		return 0;
+	}
+
+	luaL_checktype(L, 4, LUA_TTABLE);
+	lua_getfield(L, 4, "angle");
+	lua_getfield(L, 4, "wfactor");
+	lua_getfield(L, 4, "hfactor");
+	lua_Number angle = luaL_checknumber(L, -3);
+	float wfactor = luaL_checknumber(L, -2);
+	float hfactor = luaL_checknumber(L, -1);
+	lua_pop(L, 3);
+
+	float w = wi * fabsf(wfactor);
+	float h = hi * fabsf(hfactor);
+	lua_Number hx = luaL_optnumber(L, 5, w / 2);
+	lua_Number hy = luaL_optnumber(L, 6, h / 2);
+
+	if (wfactor < 0) {
+		xi += wi;
+		wi = -wi;
+	}
+	if (hfactor < 0) {
+		yi += hi;
+		hi = -hi;
+	}
+
+	display_draw_sprite(xi, yi, wi, hi, x, y, w, h, angle, hx, hy);
+	return 0;
+}
+
+int mlua_draw_sprite_rotated(lua_State* L)
+{
+	assert(L);
+
+	float xi, yi, wi, hi;
+	get_sprite(L, 1, "draw_sprite_rotated", &xi, &yi, &wi, &hi);
+	lua_Number x = luaL_checknumber(L, 2);
+	lua_Number y = luaL_checknumber(L, 3);
+	lua_Number angle = luaL_checknumber(L, 4);
+	lua_Number hx = luaL_optnumber(L, 5, wi / 2);
+	lua_Number hy = luaL_optnumber(L, 6, hi / 2);
+	check_textured_draw(L, "draw_sprite_rotated", NULL);
+
+	display_draw_sprite(xi, yi, wi, hi, x, y, wi, hi, angle, hx, hy);
+	return 0;
+}
+
+int mlua_draw_sprite_resized(lua_State* L)
+{
+	assert(L);
+
+	float xi, yi, wi, hi;
+	get_sprite(L, 1, "draw_sprite_resized", &xi, &yi, &wi, &hi);
+	lua_Number x = luaL_checknumber(L, 2);
+	lua_Number y = luaL_checknumber(L, 3);
+	lua_Number w = luaL_optnumber(L, 4, wi);
+	lua_Number h = luaL_optnumber(L, 5, hi);
+	check_textured_draw(L, "draw_sprite_resized", NULL);
+
+	display_draw_sprite(xi, yi, wi, hi, x, y, w, h, 0, 0, 0);
+	return 0;
+}
+
+int mlua_draw_rect_rotated(lua_State* L)
+{
+	assert(L);
+
+	Buffer* buffer = display_get_current_buffer();
+	assert_lua_error(L, !buffer->user_buffer || buffer_is_empty(buffer) || !buffer->has_texture,
+					 "draw_rect_rotated: the current buffer cannot contain non textured triangles");
+
+	lua_Number x = luaL_checknumber(L, 1);
+	lua_Number y = luaL_checknumber(L, 2);
+	lua_Number w = luaL_checknumber(L, 3);
+	lua_Number h = luaL_checknumber(L, 4);
+	lua_Number angle = luaL_checknumber(L, 5);
+	lua_Number hx = luaL_optnumber(L, 6, w / 2);
+	lua_Number hy = luaL_optnumber(L, 7, h / 2);
+	display_draw_rect_rotated(x, y, w, h, angle, hx, hy);
+	return 0;
+}
+
+static void check_shape_draw(lua_State* L, const char* func)
+{
+	Buffer* buffer = display_get_current_buffer();
+	if (buffer->user_buffer && !buffer_is_empty(buffer) && buffer->has_texture)
+		luaL_error(L, "%s: the current buffer cannot contain non textured triangles", func);
+}
+
+static bool is_coords(lua_State* L, int index)
+{
+	return lua_istable(L, index) || float_array_test(L, index);
+}
+
+/**
+ * Returns the coordinates (x1, y1, x2, y2, ...) given as a table, a float_array
+ * or as numbers from index to the top of the stack, and sets n to the number of points.
+ */
+static const float *get_coords(lua_State* L, int index, const char* func, size_t *n)
+{
+	static float *coords;
+	static size_t coords_size;
+	size_t len;
+
+	FloatArray *array = float_array_test(L, index);
+	if (array) {
+		len = array->size;
+		if (len % 2)
+			luaL_error(L, "%s: coordinates should be pairs of x and y", func);
+		*n = len / 2;
+		return array->values;
+	}
+
+	if (lua_istable(L, index)) {
+		len = lua_rawlen(L, index);
+		XREALLOC(coords, coords_size, len);
+		for (size_t i = 0; i < len; i++) {
+			lua_rawgeti(L, index, i + 1);
+			coords[i] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+	} else {
+		int top = lua_gettop(L);
+		len = top >= index ? top - index + 1 : 0;
+		XREALLOC(coords, coords_size, len);
+		for (size_t i = 0; i < len; i++)
+			coords[i] = luaL_checknumber(L, index + i);
+	}
+	if (len % 2)
+		luaL_error(L, "%s: coordinates should be pairs of x and y", func);
+	*n = len / 2;
+	return coords;
+}
+
+int mlua_draw_circle(lua_State* L)
+{
+	assert(L);
+
+	check_shape_draw(L, "draw_circle");
+
+	lua_Number x = luaL_checknumber(L, 1);
+	lua_Number y = luaL_checknumber(L, 2);
+	lua_Number r = luaL_checknumber(L, 3);
+	display_draw_circle(x, y, r);
+	return 0;
+}
+
+/**
+ * draw_polygon(x1, y1, x2, y2, ...) or draw_polygon(coords)
+ */
+int mlua_draw_polygon(lua_State* L)
+{
+	assert(L);
+
+	size_t n;
+
+	check_shape_draw(L, "draw_polygon");
+
+	const float *coords = get_coords(L, 1, "draw_polygon", &n);
+	display_draw_polygon(coords, n);
+	return 0;
+}
+
+/**
+ * draw_polyline(loop, [width, ]x1, y1, x2, y2, ...)
+ * or draw_polyline(loop, coords[, width]) or draw_polyline(loop, width, coords)
+ */
+int mlua_draw_polyline(lua_State* L)
+{
+	assert(L);
+
+	const float *coords;
+	size_t n;
+	lua_Number width = 1;
+
+	check_shape_draw(L, "draw_polyline");
+
+	bool loop = lua_toboolean(L, 1);
+	if (is_coords(L, 2)) {
+		coords = get_coords(L, 2, "draw_polyline", &n);
+		width = luaL_optnumber(L, 3, 1);
+	} else if (is_coords(L, 3)) {
+		width = luaL_checknumber(L, 2);
+		coords = get_coords(L, 3, "draw_polyline", &n);
+	} else if (lua_gettop(L) % 2 == 0) {
+		// odd number of numbers, the first one is the width
+		width = luaL_checknumber(L, 2);
+		coords = get_coords(L, 3, "draw_polyline", &n);
+	} else {
+		coords = get_coords(L, 2, "draw_polyline", &n);
+	}
+	assert_lua_error(L, width >= 0, "draw_polyline: width must be >= 0");
+	display_draw_polyline(coords, n, loop, width);
+	return 0;
+}
+
+int mlua_draw_square(lua_State* L)
+{
+	assert(L);
+
+	check_shape_draw(L, "draw_square");
+
+	lua_Number x = luaL_checknumber(L, 1);
+	lua_Number y = luaL_checknumber(L, 2);
+	lua_Number w = luaL_checknumber(L, 3);
+	lua_Number h = luaL_checknumber(L, 4);
+	lua_Number width = luaL_optnumber(L, 5, 1);
+	assert_lua_error(L, width >= 0, "draw_square: width must be >= 0");
+	display_draw_square(x, y, w, h, width);
+	return 0;
+}
+
+/**
+ * draw_sprites(sprite_or_surface, array)
+ * array is a table or a float_array containing, for each sprite:
+ * x, y, angle, scale, color (0xRRGGBB)
+ */
+int mlua_draw_sprites(lua_State* L)
+{
+	assert(L);
+
+	Surface *surface = NULL;
+	float xi, yi, wi, hi;
+	size_t len;
+
+	if (lua_istable(L, 1)) {
+		get_sprite(L, 1, "draw_sprites", &xi, &yi, &wi, &hi);
+	} else {
+		surface = pop_surface(L, 1);
+		xi = yi = 0;
+		wi = surface->w;
+		hi = surface->h;
+	}
+
+	FloatArray *array = float_array_test(L, 2);
+	if (array) {
+		len = array->size;
+	} else {
+		luaL_checktype(L, 2, LUA_TTABLE);
+		len = lua_rawlen(L, 2);
+	}
+	assert_lua_error(L, len % 5 == 0, "draw_sprites: array should contain x, y, angle, scale and color for each sprite");
+
+	check_textured_draw(L, "draw_sprites", surface);
+
+	Surface *old_from = display_get_draw_from();
+	int old_r, old_g, old_b;
+	display_get_color(&old_r, &old_g, &old_b);
+	if (surface)
+		display_draw_from(surface);
+
+	for (size_t i = 0; i < len; i += 5) {
+		float values[5];
+		if (array) {
+			memcpy(values, array->values + i, sizeof(values));
+		} else {
+			for (int j = 0; j < 5; j++) {
+				lua_rawgeti(L, 2, i + j + 1);
+				values[j] = lua_tonumber(L, -1);
+				lua_pop(L, 1);
+			}
+		}
+
+		float x = values[0];
+		float y = values[1];
+		float angle = values[2];
+		float scale = values[3];
+		// out of range or NaN colors cannot be converted to an integer
+		if (!(values[4] >= 0 && values[4] <= 0xffffffffu)) {
+			display_set_color(old_r, old_g, old_b);
+			if (surface)
+				display_draw_from(old_from);
+			return luaL_error(L, "draw_sprites: the color of the sprite %d is invalid", (int) (i / 5 + 1));
+		}
+		uint32_t color = (uint32_t) (int64_t) values[4];
+		float w = wi * scale;
+		float h = hi * scale;
+
+		display_set_color((color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff);
+		display_draw_sprite(xi, yi, wi, hi, x, y, w, h, angle, w / 2, h / 2);
+	}
+
+	display_set_color(old_r, old_g, old_b);
+	if (surface)
+		display_draw_from(old_from);
+	return 0;
+}
@@ -23,10 +23,17 @@
 
 DECLARE_PUSHPOP(Surface, surface)
 
+void push_load_surface_error(lua_State* L, const char *name, int r);
+
 int mlua_set_color(lua_State* L);
 int mlua_set_alpha(lua_State* L);
 int mlua_set_title(lua_State* L);
 int mlua_set_blend_mode(lua_State* L);
+int mlua_set_deferred(lua_State* L);
+int mlua_flush(lua_State* L);
+int mlua_set_direct_rendering(lua_State* L);
+int mlua_set_culling(lua_State* L);
+int mlua_set_cpu_camera(lua_State* L);
 
 int mlua_show_cursor(lua_State* L);
 int mlua_resize(lua_State* L);
@@ -35,18 +42,34 @@ int mlua_screen2scene(lua_State* L);
 
 int mlua_surface_class_index(lua_State* L);
 int mlua_load_surface(lua_State* L);
+int mlua_load_surface_async(lua_State* L);
+int mlua_set_texture_cache(lua_State* L);
 int mlua_new_surface(lua_State* L);
 int mlua_free_surface(lua_State* L);
 int mlua_draw_on_surface(lua_State* L);
 int mlua_draw_from_surface(lua_State* L);
 int mlua_set_filter_surface(lua_State* L);
 int mlua_get_pixel_surface(lua_State* L);
+int mlua_get_pixels_surface(lua_State* L);
+int mlua_lock_surface(lua_State* L);
+int mlua_unlock_surface(lua_State* L);
 
 int mlua_draw_background(lua_State *L);
 int mlua_draw_point(lua_State* L);
 int mlua_draw_point_tex(lua_State* L);
 int mlua_draw_line(lua_State* L);
 int mlua_draw_triangle(lua_State* L);
+int mlua_draw_rect(lua_State* L);
+int mlua_draw_rect_rotated(lua_State* L);
+int mlua_draw_circle(lua_State* L);
+int mlua_draw_polygon(lua_State* L);
+int mlua_draw_polyline(lua_State* L);
+int mlua_draw_square(lua_State* L);
 int mlua_draw_surface(lua_State* L);
 int mlua_draw_quad(lua_State* L);
+int mlua_draw_sprite(lua_State* L);
+int mlua_draw_sprite_simple(lua_State* L);
+int mlua_draw_sprite_rotated(lua_State* L);
+int mlua_draw_sprite_resized(lua_State* L);
+int mlua_draw_sprites(lua_State* L);
 
@@ -0,0 +1,89 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <string.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "float_array_bind.h"
+#include "lua_util.h"
+
+FloatArray *float_array_check(lua_State *L, int index)
+{
+	assert(L);
+
+	return (FloatArray *) luaL_checkudata(L, index, "float_array");
+}
+
+FloatArray *float_array_test(lua_State *L, int index)
+{
+	assert(L);
+
+	return (FloatArray *) luaL_testudata(L, index, "float_array");
+}
+
+int mlua_new_float_array(lua_State *L)
+{
+	assert(L);
+
+	lua_Integer size = luaL_checkinteger(L, 1);
+	assert_lua_error(L, size >= 0, "new_float_array: size should be positive");
+
+	FloatArray *array = (FloatArray *) lua_newuserdata(L, sizeof(FloatArray) + size * sizeof(float));
+	array->size = size;
+	memset(array->values, 0, size * sizeof(float));
+	luaL_setmetatable(L, "float_array");
+	return 1;
+}
+
+int mlua_float_array_class_index(lua_State *L)
+{
+	assert(L);
+
+	FloatArray *array = float_array_check(L, 1);
+	if (!lua_isnumber(L, 2))
+		return 0;
+
+	lua_Integer i = lua_tointeger(L, 2);
+	if (i < 1 || (size_t) i > array->size)
+		return 0;
+
+	lua_pushnumber(L, array->values[i - 1]);
+	return 1;
+}
+
+int mlua_float_array_class_newindex(lua_State *L)
+{
+	assert(L);
+
+	FloatArray *array = float_array_check(L, 1);
+	lua_Integer i = luaL_checkinteger(L, 2);
+	lua_Number value = luaL_checknumber(L, 3);
+	assert_lua_error(L, i >= 1 && (size_t) i <= array->size, "float_array: index out of bounds");
+
+	array->values[i - 1] = value;
+	return 0;
+}
+
+int mlua_float_array_len(lua_State *L)
+{
+	assert(L);
+
+	FloatArray *array = float_array_check(L, 1);
+	lua_pushinteger(L, array->size);
+	return 1;
+}
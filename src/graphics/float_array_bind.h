@@ -0,0 +1,37 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <lua.h>
+
+typedef struct FloatArray FloatArray;
+
+// array of floats allocated as a userdata, it can be filled by the game
+// and read by draw_sprites without converting Lua tables
+struct FloatArray {
+	size_t size;
+	float values[];
+};
+
+FloatArray *float_array_check(lua_State *L, int index);
+FloatArray *float_array_test(lua_State *L, int index);
+
+int mlua_new_float_array(lua_State *L);
+int mlua_float_array_class_index(lua_State *L);
+int mlua_float_array_class_newindex(lua_State *L);
+int mlua_float_array_len(lua_State *L);
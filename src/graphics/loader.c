@@ -0,0 +1,268 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#ifndef EMSCRIPTEN
+#include <pthread.h>
+#endif
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "loader.h"
+#include "display.h"
+#include "display_bind.h"
+#include "dlua.h"
+#include "lua_util.h"
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+
+log_category("loader");
+
+typedef struct LoadRequest LoadRequest;
+struct LoadRequest {
+	char *filename;
+	bool atlas;
+	int callback_ref;
+
+	int result;
+	SurfaceImage image;
+
+	LoadRequest *next;
+};
+
+typedef struct LoadQueue {
+	LoadRequest *head;
+	LoadRequest *tail;
+} LoadQueue;
+
+static struct {
+	// requests waiting to be decoded
+	LoadQueue pending;
+	// requests decoded and waiting to be uploaded
+	LoadQueue decoded;
+#ifndef EMSCRIPTEN
+	pthread_t worker_tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool worker_running;
+	bool stop;
+#endif
+} loader = {
+#ifndef EMSCRIPTEN
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+#endif
+};
+
+static void queue_push(LoadQueue *q, LoadRequest *request)
+{
+	assert(q);
+	assert(request);
+
+	request->next = NULL;
+	if (q->tail)
+		q->tail->next = request;
+	else
+		q->head = request;
+	q->tail = request;
+}
+
+static LoadRequest *queue_pop(LoadQueue *q)
+{
+	assert(q);
+
+	LoadRequest *request = q->head;
+	if (request) {
+		q->head = request->next;
+		if (!q->head)
+			q->tail = NULL;
+		request->next = NULL;
+	}
+	return request;
+}
+
+static void request_decode(LoadRequest *request)
+{
+	assert(request);
+
+	request->result = surface_decode(request->filename, &request->image);
+}
+
+static void request_free(LoadRequest *request)
+{
+	assert(request);
+
+	if (request->image.data)
+		surface_image_free(&request->image);
+	free(request->filename);
+	free(request);
+}
+
+#ifndef EMSCRIPTEN
+static void *worker_loop(_unused_ void *arg)
+{
+	for (;;) {
+		pthread_mutex_lock(&loader.mutex);
+		while (!loader.stop && !loader.pending.head)
+			pthread_cond_wait(&loader.cond, &loader.mutex);
+		if (loader.stop) {
+			pthread_mutex_unlock(&loader.mutex);
+			break;
+		}
+		LoadRequest *request = queue_pop(&loader.pending);
+		pthread_mutex_unlock(&loader.mutex);
+
+		request_decode(request);
+
+		pthread_mutex_lock(&loader.mutex);
+		queue_push(&loader.decoded, request);
+		pthread_mutex_unlock(&loader.mutex);
+	}
+
+	return NULL;
+}
+
+static void loader_start_worker(void)
+{
+	int r;
+
+	loader.stop = false;
+	r = pthread_create(&loader.worker_tid, NULL, worker_loop, NULL);
+	if (r) {
+		log_error("Cannot create the loading thread, images will be decoded on the main thread");
+		return;
+	}
+	loader.worker_running = true;
+}
+#endif
+
+void loader_push(const char *filename, bool atlas, int callback_ref)
+{
+	assert(filename);
+
+	LoadRequest *request = new0(LoadRequest, 1);
+	request->filename = xstrdup(filename);
+	request->atlas = atlas;
+	request->callback_ref = callback_ref;
+
+#ifndef EMSCRIPTEN
+	if (!loader.worker_running)
+		loader_start_worker();
+
+	pthread_mutex_lock(&loader.mutex);
+	queue_push(&loader.pending, request);
+	pthread_cond_signal(&loader.cond);
+	pthread_mutex_unlock(&loader.mutex);
+#else
+	queue_push(&loader.pending, request);
+#endif
+}
+
+static LoadRequest *loader_pop_decoded(size_t budget, bool first)
+{
+	LoadRequest *request;
+
+#ifndef EMSCRIPTEN
+	if (loader.worker_running) {
+		pthread_mutex_lock(&loader.mutex);
+		request = loader.decoded.head;
+		if (request && (first || (size_t) request->image.w * request->image.h * 4 <= budget))
+			queue_pop(&loader.decoded);
+		else
+			request = NULL;
+		pthread_mutex_unlock(&loader.mutex);
+		return request;
+	}
+#endif
+
+	// no worker thread, decode one image per frame on the main thread
+	if (!first)
+		return NULL;
+	request = queue_pop(&loader.pending);
+	if (request)
+		request_decode(request);
+	return request;
+}
+
+static void loader_deliver(LoadRequest *request)
+{
+	assert(request);
+
+	lua_State *L = dlua_get_lua_state();
+	Surface *surface = NULL;
+
+	if (request->result >= 0)
+		surface = display_upload_surface(request->filename, &request->image, request->atlas);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, request->callback_ref);
+	luaL_unref(L, LUA_REGISTRYINDEX, request->callback_ref);
+	request->callback_ref = LUA_NOREF;
+	if (surface) {
+		push_surface(L, surface);
+		lua_pushnil(L);
+	} else {
+		push_load_surface_error(L, "load_surface_async", request->result);
+	}
+	request_free(request);
+
+	call_lua_function(L, 2, 0);
+}
+
+void loader_update(void)
+{
+	size_t budget = LOADER_UPLOAD_BUDGET;
+	bool first = true;
+	LoadRequest *request;
+
+	while ((request = loader_pop_decoded(budget, first))) {
+		size_t size = (size_t) request->image.w * request->image.h * 4;
+		budget = size < budget ? budget - size : 0;
+		first = false;
+
+		loader_deliver(request);
+	}
+}
+
+static void loader_drop_queue(LoadQueue *q)
+{
+	LoadRequest *request;
+	lua_State *L = dlua_get_lua_state();
+
+	while ((request = queue_pop(q))) {
+		luaL_unref(L, LUA_REGISTRYINDEX, request->callback_ref);
+		request_free(request);
+	}
+}
+
+void loader_free(void)
+{
+#ifndef EMSCRIPTEN
+	if (loader.worker_running) {
+		pthread_mutex_lock(&loader.mutex);
+		loader.stop = true;
+		pthread_cond_signal(&loader.cond);
+		pthread_mutex_unlock(&loader.mutex);
+		pthread_join(loader.worker_tid, NULL);
+		loader.worker_running = false;
+	}
+#endif
+
+	loader_drop_queue(&loader.pending);
+	loader_drop_queue(&loader.decoded);
+}
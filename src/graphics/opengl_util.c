@@ -22,9 +22,25 @@
 #include <SDL/SDL_opengl.h>
 #endif
 
+#include <assert.h>
+#include <string.h>
+
 #include "opengl_util.h"
 #include "log.h"
 
+#define GL_STATE_ATTRIBUTES 3
+
+static struct GLState {
+	GLuint program;
+	GLuint texture;
+	GLuint array_buffer;
+	GLuint element_array_buffer;
+	GLenum blend_equation;
+	GLenum blend_sfactor;
+	GLenum blend_dfactor;
+	bool attrib_enabled[GL_STATE_ATTRIBUTES];
+} state;
+
 void check_opengl_oom(void)
 {
 	GLenum e;
@@ -34,6 +50,129 @@ void check_opengl_oom(void)
 		log_oom_and_exit();
 }
 
+/**
+ * Sets the shadowed state to the state of a new context.
+ */
+void gl_state_reset(void)
+{
+	memset(&state, 0, sizeof(state));
+	state.blend_equation = GL_FUNC_ADD;
+	state.blend_sfactor = GL_ONE;
+	state.blend_dfactor = GL_ZERO;
+}
+
+void gl_use_program(GLuint program)
+{
+	if (state.program != program) {
+		state.program = program;
+		glUseProgram(program);
+	}
+}
+
+void gl_bind_texture(GLuint texture)
+{
+	if (state.texture != texture) {
+		state.texture = texture;
+		glBindTexture(GL_TEXTURE_2D, texture);
+	}
+}
+
+void gl_bind_buffer(GLenum target, GLuint buffer)
+{
+	GLuint *bound;
+
+	assert(target == GL_ARRAY_BUFFER || target == GL_ELEMENT_ARRAY_BUFFER);
+
+	bound = target == GL_ARRAY_BUFFER ? &state.array_buffer : &state.element_array_buffer;
+	if (*bound != buffer) {
+		*bound = buffer;
+		glBindBuffer(target, buffer);
+	}
+}
+
+void gl_blend(GLenum equation, GLenum sfactor, GLenum dfactor)
+{
+	if (state.blend_sfactor != sfactor || state.blend_dfactor != dfactor) {
+		state.blend_sfactor = sfactor;
+		state.blend_dfactor = dfactor;
+		glBlendFunc(sfactor, dfactor);
+	}
+	if (state.blend_equation != equation) {
+		state.blend_equation = equation;
+		glBlendEquation(equation);
+	}
+}
+
+void gl_vertex_attrib_array(GLuint index, bool enabled)
+{
+	assert(index < GL_STATE_ATTRIBUTES);
+
+	if (state.attrib_enabled[index] != enabled) {
+		state.attrib_enabled[index] = enabled;
+		if (enabled)
+			glEnableVertexAttribArray(index);
+		else
+			glDisableVertexAttribArray(index);
+	}
+}
+
+void gl_delete_program(GLuint program)
+{
+	// a program in use is not deleted until another one is used
+	if (state.program == program)
+		gl_use_program(0);
+	glDeleteProgram(program);
+}
+
+void gl_delete_texture(GLuint texture)
+{
+	// deleting a bound object binds 0
+	if (state.texture == texture)
+		state.texture = 0;
+	glDeleteTextures(1, &texture);
+}
+
+void gl_delete_buffer(GLuint buffer)
+{
+	if (state.array_buffer == buffer)
+		state.array_buffer = 0;
+	if (state.element_array_buffer == buffer)
+		state.element_array_buffer = 0;
+	glDeleteBuffers(1, &buffer);
+}
+
+void gl_uniform1f(GLint location, GLfloat *cached, GLfloat value)
+{
+	assert(cached);
+
+	if (*cached != value) {
+		*cached = value;
+		glUniform1f(location, value);
+	}
+}
+
+void gl_uniform2f(GLint location, GLfloat cached[2], GLfloat x, GLfloat y)
+{
+	assert(cached);
+
+	if (cached[0] != x || cached[1] != y) {
+		cached[0] = x;
+		cached[1] = y;
+		glUniform2f(location, x, y);
+	}
+}
+
+void gl_uniform_matrix2fv(GLint location, GLfloat cached[4], const GLfloat value[4])
+{
+	assert(cached);
+	assert(value);
+
+	if (memcmp(cached, value, 4 * sizeof(GLfloat))) {
+		memcpy(cached, value, 4 * sizeof(GLfloat));
+		glUniformMatrix2fv(location, 1, GL_FALSE, value);
+	}
+}
+
 #ifndef NDEBUG
 const char* getGLError(GLenum error)
 {
@@ -24,12 +24,35 @@
 #include <SDL/SDL_opengl.h>
 #endif
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 #include "log.h"
 
 void check_opengl_oom(void);
 
+/*
+ * Shadow of the OpenGL state, to skip the calls which would not change it.
+ * Every change of these states must go through these functions.
+ */
+void gl_state_reset(void);
+void gl_use_program(GLuint program);
+void gl_bind_texture(GLuint texture);
+void gl_bind_buffer(GLenum target, GLuint buffer);
+void gl_blend(GLenum equation, GLenum sfactor, GLenum dfactor);
+void gl_vertex_attrib_array(GLuint index, bool enabled);
+void gl_delete_program(GLuint program);
+void gl_delete_texture(GLuint texture);
+void gl_delete_buffer(GLuint buffer);
+
+/*
+ * Uniforms of the current program, *cached holds the last value sent to
+ * the location (uniforms are 0 once the program is linked)
+ */
+void gl_uniform1f(GLint location, GLfloat *cached, GLfloat value);
+void gl_uniform2f(GLint location, GLfloat cached[2], GLfloat x, GLfloat y);
+void gl_uniform_matrix2fv(GLint location, GLfloat cached[4], const GLfloat value[4]);
+
 #ifndef NDEBUG
 const char* getGLError(GLenum error);
 
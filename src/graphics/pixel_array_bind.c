@@ -0,0 +1,270 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <string.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "pixel_array_bind.h"
+#include "lua_util.h"
+#include "macro.h"
+#include "util.h"
+
+/**
+ * Pushes a new pixel array of w * h pixels, left uninitialized.
+ */
+PixelArray *pixel_array_new(lua_State *L, unsigned int w, unsigned int h)
+{
+	assert(L);
+
+	PixelArray *array = (PixelArray *) lua_newuserdata(L, sizeof(PixelArray) + (size_t) w * h * 4);
+	array->w = w;
+	array->h = h;
+	array->pixels = array->values;
+	array->surface = NULL;
+	luaL_setmetatable(L, "pixel_array");
+	return array;
+}
+
+/**
+ * Pushes a pixel array sharing the pixels of a locked surface.
+ * The surface (at 'surface_index' in the stack) is kept alive by the array.
+ */
+PixelArray *pixel_array_new_view(lua_State *L, int surface_index, Surface *surface)
+{
+	assert(L);
+	assert(surface);
+	assert(surface->locked);
+
+	surface_index = lua_absindex(L, surface_index);
+	PixelArray *array = (PixelArray *) lua_newuserdata(L, sizeof(PixelArray));
+	array->w = surface->w;
+	array->h = surface->h;
+	array->pixels = surface->pixels;
+	array->surface = surface;
+	luaL_setmetatable(L, "pixel_array");
+	lua_pushvalue(L, surface_index);
+	lua_setuservalue(L, -2);
+	return array;
+}
+
+PixelArray *pixel_array_check(lua_State *L, int index)
+{
+	assert(L);
+
+	return (PixelArray *) luaL_checkudata(L, index, "pixel_array");
+}
+
+static PixelArray *pixel_array_check_usable(lua_State *L, int index, const char *name)
+{
+	PixelArray *array = pixel_array_check(L, index);
+	if (array->surface && (!array->surface->locked || array->surface->pixels != array->pixels))
+		luaL_error(L, "%s: the surface of the pixel array is not locked anymore", name);
+	return array;
+}
+
+static void pixel_array_modified(PixelArray *array, int x0, int y0, int x1, int y1)
+{
+	if (array->surface)
+		surface_mark_modified(array->surface, x0, y0, x1, y1);
+}
+
+static void check_color(lua_State *L, int index, unsigned char color[4])
+{
+	for (int i = 0; i < 4; i++) {
+		lua_Integer c = i == 3 ? luaL_optinteger(L, index + i, 255) : luaL_checkinteger(L, index + i);
+		color[i] = MAX(0, MIN(c, 255));
+	}
+}
+
+int mlua_pixel_array_class_index(lua_State *L)
+{
+	assert(L);
+
+	PixelArray *array = pixel_array_check(L, 1);
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		// raw access to the bytes
+		array = pixel_array_check_usable(L, 1, "pixel_array");
+		lua_Integer i = lua_tointeger(L, 2);
+		if (i < 1 || (size_t) i > (size_t) array->w * array->h * 4)
+			return 0;
+		lua_pushinteger(L, array->pixels[i - 1]);
+		return 1;
+	}
+
+	const char* index = luaL_checkstring(L, 2);
+	if (streq(index, "w")) {
+		lua_pushinteger(L, array->w);
+	} else if (streq(index, "h")) {
+		lua_pushinteger(L, array->h);
+	} else {
+		lua_getmetatable(L, 1);
+		lua_getfield(L, -1, index);
+	}
+	return 1;
+}
+
+int mlua_pixel_array_class_newindex(lua_State *L)
+{
+	assert(L);
+
+	PixelArray *array = pixel_array_check_usable(L, 1, "pixel_array");
+	lua_Integer i = luaL_checkinteger(L, 2);
+	lua_Integer value = luaL_checkinteger(L, 3);
+	assert_lua_error(L, i >= 1 && (size_t) i <= (size_t) array->w * array->h * 4, "pixel_array: index out of bounds");
+
+	array->pixels[i - 1] = MAX(0, MIN(value, 255));
+	unsigned int pixel = (i - 1) / 4;
+	unsigned int x = pixel % array->w;
+	unsigned int y = pixel / array->w;
+	pixel_array_modified(array, x, y, x + 1, y + 1);
+	return 0;
+}
+
+int mlua_pixel_array_len(lua_State *L)
+{
+	assert(L);
+
+	PixelArray *array = pixel_array_check(L, 1);
+	lua_pushinteger(L, (lua_Integer) array->w * array->h * 4);
+	return 1;
+}
+
+int mlua_get_pixel_array(lua_State *L)
+{
+	assert(L);
+
+	PixelArray *array = pixel_array_check_usable(L, 1, "get");
+	lua_Integer x = luaL_checkinteger(L, 2);
+	lua_Integer y = luaL_checkinteger(L, 3);
+	assert_lua_error(L, x >= 1 && (unsigned int) x <= array->w, "get: x is out of bounds");
+	assert_lua_error(L, y >= 1 && (unsigned int) y <= array->h, "get: y is out of bounds");
+
+	const unsigned char *pixel = array->pixels + ((x - 1) + (y - 1) * array->w) * 4;
+	lua_pushinteger(L, pixel[0]);
+	lua_pushinteger(L, pixel[1]);
+	lua_pushinteger(L, pixel[2]);
+	lua_pushinteger(L, pixel[3]);
+	return 4;
+}
+
+int mlua_set_pixel_array(lua_State *L)
+{
+	assert(L);
+
+	PixelArray *array = pixel_array_check_usable(L, 1, "set");
+	lua_Integer x = luaL_checkinteger(L, 2);
+	lua_Integer y = luaL_checkinteger(L, 3);
+	unsigned char color[4];
+	check_color(L, 4, color);
+	assert_lua_error(L, x >= 1 && (unsigned int) x <= array->w, "set: x is out of bounds");
+	assert_lua_error(L, y >= 1 && (unsigned int) y <= array->h, "set: y is out of bounds");
+
+	memcpy(array->pixels + ((x - 1) + (y - 1) * array->w) * 4, color, 4);
+	pixel_array_modified(array, x - 1, y - 1, x, y);
+	return 0;
+}
+
+/**
+ * fill(x, y, w, h, r, g, b[, a=255])
+ * The rectangle is clipped to the array.
+ */
+int mlua_fill_pixel_array(lua_State *L)
+{
+	assert(L);
+
+	PixelArray *array = pixel_array_check_usable(L, 1, "fill");
+	int w = array->w;
+	int h = array->h;
+	lua_Integer x = luaL_checkinteger(L, 2) - 1;
+	lua_Integer y = luaL_checkinteger(L, 3) - 1;
+	lua_Integer x0 = MAX(x, 0);
+	lua_Integer y0 = MAX(y, 0);
+	lua_Integer x1 = MIN(x + luaL_checkinteger(L, 4), w);
+	lua_Integer y1 = MIN(y + luaL_checkinteger(L, 5), h);
+	unsigned char color[4];
+	check_color(L, 6, color);
+	if (x0 >= x1 || y0 >= y1)
+		return 0;
+
+	unsigned char *row = array->pixels + (x0 + y0 * w) * 4;
+	for (lua_Integer i = x0; i < x1; i++)
+		memcpy(row + (i - x0) * 4, color, 4);
+	for (lua_Integer j = y0 + 1; j < y1; j++)
+		memcpy(array->pixels + (x0 + j * w) * 4, row, (x1 - x0) * 4);
+
+	pixel_array_modified(array, x0, y0, x1, y1);
+	return 0;
+}
+
+/**
+ * blit(source, x, y[, sx=1, sy=1, sw=source.w, sh=source.h])
+ * Copies the rectangle (sx, sy, sw, sh) of 'source' at (x, y), clipped to both arrays.
+ */
+int mlua_blit_pixel_array(lua_State *L)
+{
+	assert(L);
+
+	PixelArray *array = pixel_array_check_usable(L, 1, "blit");
+	PixelArray *source = pixel_array_check_usable(L, 2, "blit");
+	lua_Integer x = luaL_checkinteger(L, 3) - 1;
+	lua_Integer y = luaL_checkinteger(L, 4) - 1;
+	lua_Integer sx = luaL_optinteger(L, 5, 1) - 1;
+	lua_Integer sy = luaL_optinteger(L, 6, 1) - 1;
+	lua_Integer w = luaL_optinteger(L, 7, source->w);
+	lua_Integer h = luaL_optinteger(L, 8, source->h);
+
+	// clip to the source
+	if (sx < 0) {
+		w += sx;
+		x -= sx;
+		sx = 0;
+	}
+	if (sy < 0) {
+		h += sy;
+		y -= sy;
+		sy = 0;
+	}
+	w = MIN(w, (lua_Integer) source->w - sx);
+	h = MIN(h, (lua_Integer) source->h - sy);
+	// clip to the destination
+	if (x < 0) {
+		w += x;
+		sx -= x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		sy -= y;
+		y = 0;
+	}
+	w = MIN(w, (lua_Integer) array->w - x);
+	h = MIN(h, (lua_Integer) array->h - y);
+	if (w <= 0 || h <= 0)
+		return 0;
+
+	// the arrays can be the same, rows are copied in an order which does not overwrite the source
+	bool backward = source->pixels == array->pixels && y > sy;
+	for (lua_Integer i = 0; i < h; i++) {
+		lua_Integer row = backward ? h - 1 - i : i;
+		memmove(array->pixels + (x + (y + row) * array->w) * 4,
+		        source->pixels + (sx + (sy + row) * source->w) * 4, w * 4);
+	}
+
+	pixel_array_modified(array, x, y, x + w, y + h);
+	return 0;
+}
@@ -0,0 +1,46 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <lua.h>
+
+#include "surface.h"
+
+typedef struct PixelArray PixelArray;
+
+// RGBA pixels, rows from top to bottom
+struct PixelArray {
+	unsigned int w;
+	unsigned int h;
+	unsigned char *pixels;
+	// if set, 'pixels' is the CPU copy of this surface, usable while it is locked
+	Surface *surface;
+	// pixels of the array if it is not a view of a surface
+	unsigned char values[];
+};
+
+PixelArray *pixel_array_new(lua_State *L, unsigned int w, unsigned int h);
+PixelArray *pixel_array_new_view(lua_State *L, int surface_index, Surface *surface);
+PixelArray *pixel_array_check(lua_State *L, int index);
+
+int mlua_pixel_array_class_index(lua_State *L);
+int mlua_pixel_array_class_newindex(lua_State *L);
+int mlua_pixel_array_len(lua_State *L);
+int mlua_get_pixel_array(lua_State *L);
+int mlua_set_pixel_array(lua_State *L);
+int mlua_fill_pixel_array(lua_State *L);
+int mlua_blit_pixel_array(lua_State *L);
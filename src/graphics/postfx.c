@@ -0,0 +1,190 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "postfx.h"
+#include "display.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+log_category("postfx");
+
+typedef struct RenderTarget RenderTarget;
+struct RenderTarget {
+	Surface *surface;
+	// set while a chain draws on it or reads from it
+	bool used;
+	// number of frames since the last time it was acquired
+	unsigned int idle_frames;
+
+	RenderTarget *next;
+};
+
+// render targets are reused between passes and between frames instead of being allocated each time
+static RenderTarget *targets;
+
+/**
+ * Returns an unused render target of the given size, allocating a new one if the pool has none.
+ * The target keeps the content of its previous use.
+ */
+Surface *postfx_acquire_target(unsigned int w, unsigned int h)
+{
+	assert(w > 0);
+	assert(h > 0);
+
+	for (RenderTarget *t = targets; t; t = t->next) {
+		if (!t->used && t->surface->w == w && t->surface->h == h) {
+			t->used = true;
+			t->idle_frames = 0;
+			return t->surface;
+		}
+	}
+
+	// RGBA is the only color format always renderable with GLES2
+	RenderTarget *t = new0(RenderTarget, 1);
+	t->surface = display_new_surface(w, h, true);
+	t->used = true;
+	t->next = targets;
+	targets = t;
+	log_debug("new render target %dx%d", w, h);
+	return t->surface;
+}
+
+void postfx_release_target(Surface *target)
+{
+	assert(target);
+
+	for (RenderTarget *t = targets; t; t = t->next) {
+		if (t->surface == target) {
+			assert(t->used);
+			t->used = false;
+			return;
+		}
+	}
+	assert(false);
+}
+
+static void postfx_draw_pass(Surface *src, Surface *dst, Shader *shader)
+{
+	display_draw_on(dst);
+	display_draw_from(src);
+	if (shader)
+		display_use_shader(shader);
+	else
+		display_use_default_shader();
+
+	float sw = src->w;
+	float sh = src->h;
+	float dw = dst->w;
+	float dh = dst->h;
+	display_draw_quad(0, 0, sw, 0, sw, sh, 0, sh,
+	                  0, 0, dw, 0, dw, dh, 0, dh);
+}
+
+/**
+ * Applies the passes to the surface. Each pass draws the result of the previous one with its shader
+ * (or the default shader if NULL) on a pooled target, scaled from the size of the surface by scales[i]
+ * (1 if scales is NULL). Only the last pass writes to the surface, whatever its scale.
+ */
+void postfx_apply(Surface *surface, Shader **shaders, const float *scales, unsigned int count)
+{
+	assert(surface);
+	assert(shaders);
+	assert(count <= POSTFX_MAX_PASSES);
+
+	if (count == 0)
+		return;
+
+	Surface *old_on = display_get_draw_on();
+	Surface *old_from = display_get_draw_from();
+	Shader *old_shader = display_get_shader();
+	Buffer *old_buffer = display_get_current_buffer();
+	Camera old_camera = *display_get_camera();
+	int r, g, b, alpha;
+	display_get_color(&r, &g, &b);
+	display_get_alpha(&alpha);
+
+	display_use_default_buffer();
+	display_set_color(255, 255, 255);
+	display_set_alpha(255);
+	display_reset_camera();
+
+	// a pass cannot read the surface it draws on, a single effect is copied back
+	unsigned int passes = count == 1 ? 2 : count;
+	Surface *src = surface;
+	for (unsigned int i = 0; i < passes; i++) {
+		Shader *shader = i < count ? shaders[i] : NULL;
+		Surface *dst = surface;
+		if (i < passes - 1) {
+			float scale = scales ? scales[i] : 1.f;
+			unsigned int w = MAX(1, (int) (surface->w * scale));
+			unsigned int h = MAX(1, (int) (surface->h * scale));
+			dst = postfx_acquire_target(w, h);
+		}
+
+		postfx_draw_pass(src, dst, shader);
+
+		// the next passes ping-pong between the released target and a new one
+		if (src != surface)
+			postfx_release_target(src);
+		src = dst;
+	}
+
+	display_draw_on(old_on);
+	// unbinds the last render target if nothing was bound, it can be freed when idle
+	display_draw_from(old_from);
+	display_use_shader(old_shader);
+	display_use_buffer(old_buffer);
+	display_set_camera_position(old_camera.dx, old_camera.dy);
+	display_set_camera_angle(old_camera.angle);
+	display_set_camera_zoom(old_camera.zoom);
+	display_set_color(r, g, b);
+	display_set_alpha(alpha);
+}
+
+/**
+ * Frees the render targets unused for POSTFX_TARGET_MAX_IDLE_FRAMES frames,
+ * so a resized screen does not keep the targets of its previous size.
+ */
+void postfx_next_frame(void)
+{
+	RenderTarget **p = &targets;
+	while (*p) {
+		RenderTarget *t = *p;
+		if (!t->used && ++t->idle_frames > POSTFX_TARGET_MAX_IDLE_FRAMES) {
+			*p = t->next;
+			log_debug("free render target %dx%d", t->surface->w, t->surface->h);
+			display_free_surface(t->surface);
+			free(t);
+		} else {
+			p = &t->next;
+		}
+	}
+}
+
+void postfx_free(void)
+{
+	while (targets) {
+		RenderTarget *t = targets;
+		targets = t->next;
+		display_free_surface(t->surface);
+		free(t);
+	}
+}
@@ -0,0 +1,33 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdbool.h>
+
+#include "surface.h"
+#include "shader.h"
+
+// number of frames a render target can stay unused in the pool before being freed
+#define POSTFX_TARGET_MAX_IDLE_FRAMES 120
+// maximum number of passes of a chain
+#define POSTFX_MAX_PASSES 32
+
+Surface *postfx_acquire_target(unsigned int w, unsigned int h);
+void postfx_release_target(Surface *target);
+void postfx_apply(Surface *surface, Shader **shaders, const float *scales, unsigned int count);
+void postfx_next_frame(void);
+void postfx_free(void);
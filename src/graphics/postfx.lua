@@ -1,66 +1,230 @@
 local drystal = require 'drystal'
 
+local apply_postfx = drystal.apply_postfx
+
+-- effects by name: code, uniforms and one shader per occurrence in a chain
 local postfxs = {}
 local builtin_postfx = {}
+-- effects made of several passes, they append their passes to the chain
+local composite_postfx = {}
+-- shaders composing several effects in one pass, by names of the effects (false if it does not compile)
+local fused_postfx = {}
 
-function drystal.add_postfx(name, code, uniforms)
-	uniforms = uniforms or {}
-	local uniforms_code = ''
-	for i, name in ipairs(uniforms) do
-		uniforms_code = uniforms_code .. [[
-			uniform float ]] .. name .. [[;
-		]]
+local function uniforms_code(uniforms)
+	local code = ''
+	for _, name in ipairs(uniforms) do
+		code = code .. 'uniform float ' .. name .. ';\n'
 	end
-	code = [[
+	return code
+end
+
+local function wrap_code(code, uniforms)
+	return [[
 		varying vec2 fTexCoord;
 		uniform sampler2D tex;
 		uniform vec2 destinationSize;
-		]] .. uniforms_code .. [[
+		]] .. uniforms_code(uniforms) .. [[
 		]] .. code .. [[
 		void main()
 		{
 			gl_FragColor = vec4(effect(tex, fTexCoord), 1.0);
 		}
 	]]
-	local shader, err = drystal.new_shader(nil, nil, code)
+end
+
+-- The first effect reads the texture, the next ones are point-wise: their texture2D calls
+-- are replaced by the color computed by the previous effect.
+local function fuse_code(group)
+	local code = [[
+		varying vec2 fTexCoord;
+		uniform sampler2D tex;
+		uniform vec2 destinationSize;
+		vec3 fxColor;
+	]]
+	for _, pass in ipairs(group) do
+		code = code .. uniforms_code(pass.postfx.uniforms)
+	end
+	for i, pass in ipairs(group) do
+		if i == 2 then
+			code = code .. '\n#define texture2D(t, c) vec4(fxColor, 1.0)\n'
+		end
+		code = code .. '\n#define effect effect' .. i .. '\n'
+			.. pass.postfx.source
+			.. '\n#undef effect\n'
+	end
+	code = code .. 'void main()\n{\n'
+	for i in ipairs(group) do
+		code = code .. 'fxColor = effect' .. i .. '(tex, fTexCoord);\n'
+	end
+	return code .. 'gl_FragColor = vec4(fxColor, 1.0);\n}\n'
+end
+
+-- the same effect can appear several times in a chain with different uniforms,
+-- each occurrence has its own shader (the compiled program is shared)
+local function get_shader(postfx, occurrence)
+	local shader = postfx.shaders[occurrence]
 	if not shader then
-		return nil, err
+		shader = assert(drystal.new_shader(nil, nil, postfx.code))
+		postfx.shaders[occurrence] = shader
 	end
-	local fx = function(backsurface, ...)
-		drystal.set_color(255, 255, 255)
-		drystal.set_alpha(255)
-		local oldx, oldy = drystal.camera.x, drystal.camera.y
-		local oldzoom, oldangle = drystal.camera.zoom, drystal.camera.angle
-		drystal.camera.reset()
-
-		shader:use()
-		for i, u in ipairs(uniforms) do
-			local v = select(i, ...) or 0
-			shader:feed(u, v)
+	return shader
+end
+
+local function get_postfx(name)
+	if not postfxs[name] then
+		local builtin = builtin_postfx[name]
+		if not builtin then
+			error('Post FX ' .. name .. ' not found.')
 		end
-		local surface = backsurface:draw_on()
-		local old = surface:draw_from()
-		drystal.draw_image(0, 0, backsurface.w, backsurface.h, 0, 0)
+		assert(drystal.add_postfx(name, builtin.code, builtin.uniforms, builtin.pointwise))
+	end
+	return postfxs[name]
+end
+
+local function get_fused(group)
+	local names = {}
+	for i, pass in ipairs(group) do
+		names[i] = pass.name
+	end
+	local key = table.concat(names, ',')
+	if fused_postfx[key] == nil then
+		local code = fuse_code(group)
+		local shader = drystal.new_shader(nil, nil, code)
+		fused_postfx[key] = shader and {
+			code = code,
+			shaders = {shader},
+		} or false
+	end
+	return fused_postfx[key]
+end
+
+local function add_shader_pass(chain, postfx, scale)
+	local occurrence = (chain.occurrences[postfx] or 0) + 1
+	chain.occurrences[postfx] = occurrence
+
+	local shader = get_shader(postfx, occurrence)
+	table.insert(chain.shaders, shader)
+	table.insert(chain.scales, scale)
+	return shader
+end
+
+local function feed(shader, pass)
+	for i, u in ipairs(pass.postfx.uniforms) do
+		shader:feed(u, pass.args[i] or 0)
+	end
+end
 
-		drystal.use_default_shader()
-		backsurface:draw_from()
-		surface:draw_on()
-		drystal.draw_image(0, 0, backsurface.w, backsurface.h, 0, 0)
+local function add_pass(chain, name, scale, ...)
+	local pass = {name = name, postfx = get_postfx(name), args = {...}}
+	feed(add_shader_pass(chain, pass.postfx, scale), pass)
+end
+
+local function add_copy_pass(chain, scale)
+	table.insert(chain.shaders, false)
+	table.insert(chain.scales, scale)
+end
 
-		if old then
-			old:draw_from()
+local function add_group(chain, group)
+	local fused = #group > 1 and get_fused(group)
+	if fused then
+		local shader = add_shader_pass(chain, fused, 1)
+		for _, pass in ipairs(group) do
+			feed(shader, pass)
+		end
+	else
+		for _, pass in ipairs(group) do
+			feed(add_shader_pass(chain, pass.postfx, 1), pass)
 		end
-		drystal.camera.x, drystal.camera.y = oldx, oldy
-		drystal.camera.zoom, drystal.camera.angle = oldzoom, oldangle
 	end
-	postfxs[name] = fx
+end
+
+-- a point-wise effect joins the pass of the previous effect, unless their uniforms collide
+local function can_fuse(group, postfx)
+	if not postfx.pointwise or #group == 0 then
+		return false
+	end
+	for _, pass in ipairs(group) do
+		if pass.postfx == postfx then
+			return false
+		end
+		for _, u in ipairs(pass.postfx.uniforms) do
+			for _, v in ipairs(postfx.uniforms) do
+				if u == v then
+					return false
+				end
+			end
+		end
+	end
+	return true
+end
+
+function drystal.postfx_chain(effects)
+	local chain = {
+		shaders = {},
+		scales = {},
+		occurrences = {},
+	}
+	local group = {}
+	for _, effect in ipairs(effects) do
+		local name = effect[1]
+		if composite_postfx[name] then
+			add_group(chain, group)
+			group = {}
+			composite_postfx[name](chain, select(2, table.unpack(effect)))
+		else
+			local postfx = get_postfx(name)
+			if not can_fuse(group, postfx) then
+				add_group(chain, group)
+				group = {}
+			end
+			table.insert(group, {name = name, postfx = postfx, args = {select(2, table.unpack(effect))}})
+		end
+	end
+	add_group(chain, group)
+	if #chain.shaders == 0 then
+		return
+	end
+	-- the last pass writes on the surface, it has to be at full resolution
+	if chain.scales[#chain.scales] ~= 1 then
+		add_copy_pass(chain, 1)
+	end
+	apply_postfx(chain.shaders, chain.scales)
+end
+
+function drystal.postfx(name, ...)
+	drystal.postfx_chain {{name, ...}}
+end
+
+function drystal.add_postfx(name, code, uniforms, pointwise)
+	uniforms = uniforms or {}
+	local wrapped = wrap_code(code, uniforms)
+	local shader, err = drystal.new_shader(nil, nil, wrapped)
+	if not shader then
+		return nil, err
+	end
+	if postfxs[name] then
+		-- the fused shaders using the previous code of the effect are stale
+		fused_postfx = {}
+	end
+	postfxs[name] = {
+		source = code,
+		code = wrapped,
+		uniforms = uniforms,
+		pointwise = pointwise,
+		shaders = {shader},
+	}
+	-- the first argument used to be the back surface, it is kept for compatibility
+	local fx = function(_, ...)
+		drystal.postfx(name, ...)
+	end
 	return fx
 end
 
-local function add_postfx(name, code, uniforms)
+local function add_postfx(name, code, uniforms, pointwise)
 	builtin_postfx[name] = {
 		code = code,
-		uniforms = uniforms
+		uniforms = uniforms,
+		pointwise = pointwise,
 	}
 end
 
@@ -70,7 +234,7 @@ add_postfx('gray', [[
 		vec3 texval = texture2D(tex, coord).rgb;
 		return mix(texval, vec3((texval.r + texval.g + texval.b) / 3.0), scale);
 	}
-]], {'scale',})
+]], {'scale',}, true)
 
 add_postfx('multiply', [[
 	vec3 effect(sampler2D tex, vec2 coord)
@@ -78,7 +242,7 @@ add_postfx('multiply', [[
 		vec3 texval = texture2D(tex, coord).rgb;
 		return vec3(r, g, b) * texval;
 	}
-]], {'r', 'g', 'b'})
+]], {'r', 'g', 'b'}, true)
 
 add_postfx('distortion', [[
 	#define pi ]] .. math.pi .. [[
@@ -119,50 +283,54 @@ add_postfx('blurDir', [[
 	}
 ]], {'dx', 'dy',})
 
-local backsurface_blur
-local backsurface_blur2
+-- dual filter blur: each downsampling pass halves the resolution, the upsampling passes go back up
+-- the taps are between the texels, so the linear filtering averages four texels per tap
+add_postfx('blurDown', [[
+	vec3 effect(sampler2D tex, vec2 coord)
+	{
+		vec2 halfpixel = offset * 0.5 / destinationSize;
+		vec3 acc = texture2D(tex, coord).rgb * 4.;
+		acc += texture2D(tex, coord - halfpixel).rgb;
+		acc += texture2D(tex, coord + halfpixel).rgb;
+		acc += texture2D(tex, coord + vec2(halfpixel.x, -halfpixel.y)).rgb;
+		acc += texture2D(tex, coord - vec2(halfpixel.x, -halfpixel.y)).rgb;
+		return acc / 8.;
+	}
+]], {'offset',})
 
-postfxs.blur = function(backsurface, power)
-	if not postfxs['blurDir'] then
-		local postfx = builtin_postfx['blurDir']
-		assert(drystal.add_postfx('blurDir', postfx.code, postfx.uniforms))
-	end
-	if power >= 100 or power < 0 then
-		error('blur: power should be between 0 and 100')
-	end
+add_postfx('blurUp', [[
+	vec3 effect(sampler2D tex, vec2 coord)
+	{
+		vec2 halfpixel = offset * 0.5 / destinationSize;
+		vec3 acc = texture2D(tex, coord + vec2(-halfpixel.x * 2., 0.)).rgb;
+		acc += texture2D(tex, coord + vec2(-halfpixel.x, halfpixel.y)).rgb * 2.;
+		acc += texture2D(tex, coord + vec2(0., halfpixel.y * 2.)).rgb;
+		acc += texture2D(tex, coord + vec2(halfpixel.x, halfpixel.y)).rgb * 2.;
+		acc += texture2D(tex, coord + vec2(halfpixel.x * 2., 0.)).rgb;
+		acc += texture2D(tex, coord + vec2(halfpixel.x, -halfpixel.y)).rgb * 2.;
+		acc += texture2D(tex, coord + vec2(0., -halfpixel.y * 2.)).rgb;
+		acc += texture2D(tex, coord + vec2(-halfpixel.x, -halfpixel.y)).rgb * 2.;
+		return acc / 12.;
+	}
+]], {'offset',})
 
-	local old = drystal.current_draw_on
-	local oldfrom = drystal.current_draw_from
-	local w, h = old.w * (100 - power + 1)/100, old.h * (100 - power + 1)/100
+-- levels of the pyramid, the offset of the taps grows from 1 to 2 within a level
+-- so the radius (about offset * 2^levels) is continuous with the power
+local BLUR_POWER_PER_LEVEL = 20
 
-	if not backsurface_blur or backsurface_blur.w ~= w or backsurface_blur.h ~= h then
-		backsurface_blur = drystal.new_surface(w, h, true)
-		backsurface_blur2 = drystal.new_surface(w, h, true)
-		collectgarbage()
+composite_postfx.blur = function(chain, power)
+	if not power or power >= 100 or power < 0 then
+		error('blur: power should be between 0 and 100')
 	end
 
-	drystal.set_alpha(255)
-	drystal.set_color(255,255,255)
-	local oldx, oldy = drystal.camera.x, drystal.camera.y
-	local oldzoom, oldangle = drystal.camera.zoom, drystal.camera.angle
-	drystal.camera.reset()
-
-	backsurface_blur:draw_on()
-	old:draw_from()
-	drystal.draw_image(0, 0, old.w, old.h, 0, 0, w, h)
-
-	postfxs['blurDir'](backsurface_blur2, 1, 0)
-	postfxs['blurDir'](backsurface_blur2, 0, 1)
-
-	old:draw_on()
-	backsurface_blur:draw_from()
-	drystal.draw_image(0, 0, w, h, 0, 0, old.w, old.h)
-
-	if oldfrom then
-		oldfrom:draw_from()
+	local levels = math.max(1, math.ceil(power / BLUR_POWER_PER_LEVEL))
+	local offset = 1 + (power - (levels - 1) * BLUR_POWER_PER_LEVEL) / BLUR_POWER_PER_LEVEL
+	for i = 1, levels do
+		add_pass(chain, 'blurDown', 0.5 ^ i, offset)
+	end
+	for i = levels - 1, 0, -1 do
+		add_pass(chain, 'blurUp', 0.5 ^ i, offset)
 	end
-	drystal.camera.x, drystal.camera.y = oldx, oldy
-	drystal.camera.zoom, drystal.camera.angle = oldzoom, oldangle
 end
 
 add_postfx('vignette', [[
@@ -173,7 +341,7 @@ add_postfx('vignette', [[
 		vec3 texval = texture2D(tex, coord).rgb;
 		return texval * smoothstep(outer, inner, d);
 	}
-]], {'outer', 'inner',})
+]], {'outer', 'inner',}, true)
 
 add_postfx('pixelate', [[
 	vec3 effect(sampler2D tex, vec2 coord) {
@@ -182,20 +350,3 @@ add_postfx('pixelate', [[
 		return texture2D(tex, c).rgb;
 	}
 ]], {'sizex', 'sizey'})
-
-local backsurface
-function drystal.postfx(name, ...)
-	if not postfxs[name] then
-		if builtin_postfx[name] then
-			local postfx = builtin_postfx[name]
-			assert(drystal.add_postfx(name, postfx.code, postfx.uniforms))
-		else
-			error('Post FX ' .. name .. ' not found.')
-		end
-	end
-	local surface = drystal.current_draw_on
-	if not backsurface or backsurface.w ~= surface.w or backsurface.h ~= surface.h then
-		backsurface = drystal.new_surface(surface.w, surface.h, true)
-	end
-	postfxs[name](backsurface, ...)
-end
@@ -0,0 +1,66 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "postfx_bind.h"
+#include "postfx.h"
+#include "shader_bind.h"
+#include "display.h"
+#include "lua_util.h"
+
+/**
+ * apply_postfx(shaders[, scales])
+ * Applies the passes on the current draw_on surface. A pass without shader (false) copies or
+ * resizes the previous result.
+ */
+int mlua_apply_postfx(lua_State *L)
+{
+	assert(L);
+
+	Shader *shaders[POSTFX_MAX_PASSES];
+	float scales[POSTFX_MAX_PASSES];
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	bool has_scales = !lua_isnoneornil(L, 2);
+	if (has_scales)
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+	size_t count = lua_rawlen(L, 1);
+	assert_lua_error(L, count <= POSTFX_MAX_PASSES, "apply_postfx: too many passes");
+	for (size_t i = 0; i < count; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		shaders[i] = lua_toboolean(L, -1) ? pop_shader(L, -1) : NULL;
+		lua_pop(L, 1);
+
+		scales[i] = 1;
+		if (has_scales) {
+			lua_rawgeti(L, 2, i + 1);
+			if (!lua_isnil(L, -1))
+				scales[i] = luaL_checknumber(L, -1);
+			lua_pop(L, 1);
+			assert_lua_error(L, scales[i] > 0 && scales[i] <= 1, "apply_postfx: scales must be > 0 and <= 1");
+		}
+	}
+
+	Surface *surface = display_get_draw_on();
+	assert_lua_error(L, surface, "apply_postfx: no surface to draw on");
+	postfx_apply(surface, shaders, scales, count);
+	return 0;
+}
@@ -16,10 +16,13 @@
  */
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
 
 #include "log.h"
 #include "shader.h"
 #include "util.h"
+#include "opengl_util.h"
 
 log_category("shader");
 
@@ -90,30 +93,304 @@ void main()
 }
 );
 
-Shader *shader_new(GLuint prog_color, GLuint prog_tex, GLuint vert, GLuint frag_color, GLuint frag_tex)
+static unsigned int shader_uniform_size(GLenum type)
 {
-	Shader *s = new(Shader, 1);
+	switch (type) {
+		case GL_FLOAT:
+			return 1;
+		case GL_FLOAT_VEC2:
+			return 2;
+		case GL_FLOAT_VEC3:
+			return 3;
+		case GL_FLOAT_VEC4:
+		case GL_FLOAT_MAT2:
+			return 4;
+		case GL_FLOAT_MAT3:
+			return 9;
+		case GL_FLOAT_MAT4:
+			return 16;
+		default:
+			return 0;
+	}
+}
 
-	s->prog_color = prog_color;
-	s->prog_tex = prog_tex;
-	s->vert = vert;
-	s->frag_color = frag_color;
-	s->frag_tex = frag_tex;
-	s->ref = 0;
+static unsigned int shader_hash(const char *name)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+
+	for (const char *c = name; *c; c++) {
+		hash ^= (unsigned char) *c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static ShaderUniform *shader_find_uniform(const Shader *s, const char *name, unsigned int hash)
+{
+	unsigned int mask = s->uniforms_capacity - 1;
+
+	for (unsigned int i = hash & mask;; i = (i + 1) & mask) {
+		ShaderUniform *u = &s->uniforms[i];
+		if (!u->name || (u->hash == hash && streq(u->name, name)))
+			return u;
+	}
+}
+
+// programs by hash of their sources
+static ShaderProgram *cache[SHADER_CACHE_BUCKETS];
 
-	s->vars[VAR_LOCATION_COLOR].dxLocation = glGetUniformLocation(prog_color, "cameraDx");
-	s->vars[VAR_LOCATION_COLOR].dyLocation = glGetUniformLocation(prog_color, "cameraDy");
-	s->vars[VAR_LOCATION_COLOR].zoomLocation = glGetUniformLocation(prog_color, "cameraZoom");
-	s->vars[VAR_LOCATION_COLOR].rotationMatrixLocation = glGetUniformLocation(prog_color, "rotationMatrix");
-	s->vars[VAR_LOCATION_COLOR].destinationSizeLocation = glGetUniformLocation(prog_color, "destinationSize");
-	s->vars[VAR_LOCATION_COLOR].sourceSizeLocation = glGetUniformLocation(prog_color, "sourceSize");
+static bool shader_is_builtin_uniform(const ShaderVars *vars, GLint location)
+{
+	return location == (GLint) vars->dxLocation
+	       || location == (GLint) vars->dyLocation
+	       || location == (GLint) vars->zoomLocation
+	       || location == (GLint) vars->rotationMatrixLocation
+	       || location == (GLint) vars->destinationSizeLocation
+	       || location == (GLint) vars->sourceSizeLocation;
+}
 
-	s->vars[VAR_LOCATION_TEX].dxLocation = glGetUniformLocation(prog_tex, "cameraDx");
-	s->vars[VAR_LOCATION_TEX].dyLocation = glGetUniformLocation(prog_tex, "cameraDy");
-	s->vars[VAR_LOCATION_TEX].zoomLocation = glGetUniformLocation(prog_tex, "cameraZoom");
-	s->vars[VAR_LOCATION_TEX].rotationMatrixLocation = glGetUniformLocation(prog_tex, "rotationMatrix");
-	s->vars[VAR_LOCATION_TEX].destinationSizeLocation = glGetUniformLocation(prog_tex, "destinationSize");
-	s->vars[VAR_LOCATION_TEX].sourceSizeLocation = glGetUniformLocation(prog_tex, "sourceSize");
+static char *shader_get_error(GLuint obj)
+{
+	int length;
+
+	if (glIsShader(obj)) {
+		glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &length);
+	} else {
+		glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &length);
+	}
+
+	char* error = NULL;
+	if (length > 1) { // make sure the error is explained here
+		error = new(char, length);
+
+		if (glIsShader(obj))
+			glGetShaderInfoLog(obj, length, NULL, error);
+		else
+			glGetProgramInfoLog(obj, length, NULL, error);
+	}
+
+	return error;
+}
+
+static GLuint shader_compile(GLenum type, const char *source)
+{
+	const char *sources[] = {
+		SHADER_PREFIX,
+		source
+	};
+
+	GLuint shader = glCreateShader(type);
+	assert(shader);
+	glShaderSource(shader, 2, sources, NULL);
+	glCompileShader(shader);
+	return shader;
+}
+
+/**
+ * Compiles and links the program. Returns -EINVAL if it fails, and sets 'error'
+ * to the log of the compiler (which may be NULL).
+ */
+static int shader_program_link(ShaderProgram *p, char **error)
+{
+	GLuint vert = shader_compile(GL_VERTEX_SHADER, p->vert_source);
+	GLuint frag = shader_compile(GL_FRAGMENT_SHADER, p->frag_source);
+
+	GLuint prog = glCreateProgram();
+	assert(prog);
+	glBindAttribLocation(prog, ATTR_LOCATION_POSITION, "position");
+	glBindAttribLocation(prog, ATTR_LOCATION_COLOR, "color");
+	glBindAttribLocation(prog, ATTR_LOCATION_TEXCOORD, "texCoord");
+	glAttachShader(prog, vert);
+	glAttachShader(prog, frag);
+	glLinkProgram(prog);
+
+	GLint status;
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE && error) {
+		*error = shader_get_error(vert);
+		if (!*error)
+			*error = shader_get_error(frag);
+		if (!*error)
+			*error = shader_get_error(prog);
+	}
+
+	// the shaders are deleted with the program
+	glDeleteShader(vert);
+	glDeleteShader(frag);
+	if (status != GL_TRUE) {
+		gl_delete_program(prog);
+		return -EINVAL;
+	}
+
+	p->prog = prog;
+	p->vars.dxLocation = glGetUniformLocation(prog, "cameraDx");
+	p->vars.dyLocation = glGetUniformLocation(prog, "cameraDy");
+	p->vars.zoomLocation = glGetUniformLocation(prog, "cameraZoom");
+	p->vars.rotationMatrixLocation = glGetUniformLocation(prog, "rotationMatrix");
+	p->vars.destinationSizeLocation = glGetUniformLocation(prog, "destinationSize");
+	p->vars.sourceSizeLocation = glGetUniformLocation(prog, "sourceSize");
+	return 0;
+}
+
+/**
+ * Returns the program of the sources, shared with the other shaders using them.
+ * The program is linked right away, so that errors are reported to the caller, unless it is
+ * made of the default sources: it is then linked the first time something is drawn with it.
+ * Returns NULL if it cannot be linked, with the log of the compiler in 'error' (which may be NULL).
+ */
+ShaderProgram *shader_program_get(const char *vert_source, const char *frag_source, char **error)
+{
+	assert(vert_source);
+	assert(frag_source);
+
+	unsigned int hash = shader_hash(vert_source) ^ (shader_hash(frag_source) * 16777619u);
+	ShaderProgram **bucket = &cache[hash % SHADER_CACHE_BUCKETS];
+	ShaderProgram *p;
+
+	for (p = *bucket; p; p = p->next) {
+		if (p->hash == hash && streq(p->vert_source, vert_source) && streq(p->frag_source, frag_source)) {
+			p->refcount++;
+			return p;
+		}
+	}
+
+	p = new0(ShaderProgram, 1);
+	p->vert_source = xstrdup(vert_source);
+	p->frag_source = xstrdup(frag_source);
+	p->hash = hash;
+	p->refcount = 1;
+
+	bool lazy = vert_source == DEFAULT_VERTEX_SHADER
+	            && (frag_source == DEFAULT_FRAGMENT_SHADER_COLOR || frag_source == DEFAULT_FRAGMENT_SHADER_TEX);
+	if (!lazy && shader_program_link(p, error) < 0) {
+		free(p->vert_source);
+		free(p->frag_source);
+		free(p);
+		return NULL;
+	}
+
+	p->next = *bucket;
+	*bucket = p;
+	return p;
+}
+
+void shader_program_release(ShaderProgram *p)
+{
+	if (!p)
+		return;
+
+	assert(p->refcount > 0);
+	if (--p->refcount)
+		return;
+
+	ShaderProgram **prev = &cache[p->hash % SHADER_CACHE_BUCKETS];
+	while (*prev != p)
+		prev = &(*prev)->next;
+	*prev = p->next;
+
+	if (p->prog)
+		gl_delete_program(p->prog);
+	free(p->vert_source);
+	free(p->frag_source);
+	free(p);
+}
+
+/**
+ * Returns the program drawing the kind of primitives 'index' with the shader,
+ * linked if it was not yet, or 0 if it cannot be linked.
+ */
+GLuint shader_use_program(Shader *s, VarLocationIndex index)
+{
+	assert(s);
+
+	ShaderProgram *p = s->programs[index];
+	if (!p->prog && !p->failed) {
+		char *error = NULL;
+		if (shader_program_link(p, &error) < 0) {
+			log_error("Cannot link shader program:\n%s", error ? error : "unknown error");
+			free(error);
+			p->failed = true;
+		}
+	}
+	return p->prog;
+}
+
+/**
+ * Resolves once the location of the float uniforms of the program,
+ * so that feeding the shader does not query OpenGL.
+ * Programs linked later are made of the default sources, which have no uniform to feed.
+ */
+static void shader_add_uniforms(Shader *s, VarLocationIndex index)
+{
+	const ShaderProgram *p = s->programs[index];
+	GLuint prog = p->prog;
+	GLint count = 0;
+	GLint max_length = 0;
+
+	if (!prog)
+		return;
+
+	glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(prog, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	char name[max_length + 1];
+
+	for (GLint i = 0; i < count; i++) {
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(prog, i, max_length + 1, NULL, &size, &type, name);
+		if (!shader_uniform_size(type) || startswith(name, "gl_"))
+			continue;
+
+		GLint location = glGetUniformLocation(prog, name);
+		if (location < 0 || shader_is_builtin_uniform(&p->vars, location))
+			continue;
+
+		// arrays are fed by their first element
+		char *bracket = strchr(name, '[');
+		if (bracket)
+			*bracket = '\0';
+
+		unsigned int hash = shader_hash(name);
+		ShaderUniform *u = shader_find_uniform(s, name, hash);
+		if (!u->name) {
+			u->name = xstrdup(name);
+			u->hash = hash;
+			u->type = type;
+			u->location[VAR_LOCATION_COLOR] = -1;
+			u->location[VAR_LOCATION_TEX] = -1;
+		} else if (u->type != type) {
+			log_warning("Uniform %s has different types in the shader, it cannot be fed to every program", name);
+			continue;
+		}
+		u->location[index] = location;
+	}
+}
+
+Shader *shader_new(ShaderProgram *program_color, ShaderProgram *program_tex)
+{
+	assert(program_color);
+	assert(program_tex);
+
+	Shader *s = new0(Shader, 1);
+
+	s->programs[VAR_LOCATION_COLOR] = program_color;
+	s->programs[VAR_LOCATION_TEX] = program_tex;
+	s->ref = 0;
+
+	GLint num_color = 0;
+	GLint num_tex = 0;
+	if (program_color->prog)
+		glGetProgramiv(program_color->prog, GL_ACTIVE_UNIFORMS, &num_color);
+	if (program_tex->prog)
+		glGetProgramiv(program_tex->prog, GL_ACTIVE_UNIFORMS, &num_tex);
+	// at most half full, so that probing stays short
+	s->uniforms_capacity = 8;
+	while (s->uniforms_capacity < 2 * (unsigned int) (num_color + num_tex))
+		s->uniforms_capacity *= 2;
+	s->uniforms = new0(ShaderUniform, s->uniforms_capacity);
+	shader_add_uniforms(s, VAR_LOCATION_COLOR);
+	shader_add_uniforms(s, VAR_LOCATION_TEX);
 
 	return s;
 }
@@ -123,39 +400,105 @@ void shader_free(Shader *s)
 	if (!s)
 		return;
 
-	glDeleteShader(s->vert);
-	glDeleteShader(s->frag_color);
-	glDeleteShader(s->frag_tex);
-	glDeleteProgram(s->prog_color);
-	glDeleteProgram(s->prog_tex);
+	for (int i = 0; i < 2; i++) {
+		ShaderProgram *p = s->programs[i];
+		// another shader could be allocated at the same address
+		if (p->uniforms_owner == s)
+			p->uniforms_owner = NULL;
+		shader_program_release(p);
+	}
 
+	for (unsigned int i = 0; i < s->uniforms_capacity; i++)
+		free(s->uniforms[i].name);
+	free(s->uniforms);
 	free(s);
 }
 
-void shader_feed(const Shader *s, const char* name, float value)
+/**
+ * Sets the value of a uniform, it is sent to the programs when they are
+ * used for drawing. Returns -ENOENT if no program of the shader uses the
+ * uniform and -EINVAL if count does not match its type.
+ */
+int shader_feed(Shader *s, const char* name, const GLfloat *values, unsigned int count)
 {
 	assert(s);
 	assert(name);
+	assert(values);
 
-	GLint prog;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &prog);
-
-	GLint locColor = glGetUniformLocation(s->prog_color, name);
-	GLint locTex = glGetUniformLocation(s->prog_tex, name);
+	ShaderUniform *u = shader_find_uniform(s, name, shader_hash(name));
+	if (!u->name)
+		return -ENOENT;
+	if (count != shader_uniform_size(u->type))
+		return -EINVAL;
 
-	if (locColor >= 0) {
-		glUseProgram(s->prog_color);
-		glUniform1f(locColor, value);
-	}
-	if (locTex >= 0) {
-		glUseProgram(s->prog_tex);
-		glUniform1f(locTex, value);
+	if (!memcmp(u->value, values, count * sizeof(GLfloat)))
+		return 0;
+	memcpy(u->value, values, count * sizeof(GLfloat));
+	for (int i = 0; i < 2; i++) {
+		if (u->location[i] >= 0) {
+			u->dirty[i] = true;
+			s->dirty[i] = true;
+		}
 	}
+	return 0;
+}
+
+/**
+ * Sends the uniforms fed since the last use of the program.
+ * The program has to be in use.
+ */
+void shader_upload_uniforms(Shader *s, VarLocationIndex index)
+{
+	assert(s);
 
-	if (locTex < 0 && locColor < 0) {
-		log_warning("Cannot feed shader: no location for %s", name);
+	ShaderProgram *p = s->programs[index];
+	if (p->uniforms_owner != s) {
+		// the program is shared, the values of another shader may have been sent
+		for (unsigned int i = 0; i < s->uniforms_capacity; i++) {
+			ShaderUniform *u = &s->uniforms[i];
+			if (u->name && u->location[index] >= 0) {
+				u->dirty[index] = true;
+				s->dirty[index] = true;
+			}
+		}
+		p->uniforms_owner = s;
 	}
 
-	glUseProgram(prog);
-}
+	if (!s->dirty[index])
+		return;
 
+	for (unsigned int i = 0; i < s->uniforms_capacity; i++) {
+		ShaderUniform *u = &s->uniforms[i];
+		if (!u->name || !u->dirty[index])
+			continue;
+
+		GLint location = u->location[index];
+		switch (u->type) {
+			case GL_FLOAT:
+				glUniform1fv(location, 1, u->value);
+				break;
+			case GL_FLOAT_VEC2:
+				glUniform2fv(location, 1, u->value);
+				break;
+			case GL_FLOAT_VEC3:
+				glUniform3fv(location, 1, u->value);
+				break;
+			case GL_FLOAT_VEC4:
+				glUniform4fv(location, 1, u->value);
+				break;
+			case GL_FLOAT_MAT2:
+				glUniformMatrix2fv(location, 1, GL_FALSE, u->value);
+				break;
+			case GL_FLOAT_MAT3:
+				glUniformMatrix3fv(location, 1, GL_FALSE, u->value);
+				break;
+			case GL_FLOAT_MAT4:
+				glUniformMatrix4fv(location, 1, GL_FALSE, u->value);
+				break;
+			default:
+				assert(false);
+		}
+		u->dirty[index] = false;
+	}
+	s->dirty[index] = false;
+}
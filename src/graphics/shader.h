@@ -23,7 +23,11 @@
 #include <SDL/SDL_opengl.h>
 #endif
 
+#include <stdbool.h>
+
 typedef struct Shader Shader;
+typedef struct ShaderUniform ShaderUniform;
+typedef struct ShaderProgram ShaderProgram;
 
 extern const char* SHADER_PREFIX;
 extern const char* DEFAULT_VERTEX_SHADER;
@@ -43,26 +47,73 @@ enum VarLocationIndex {
 };
 typedef enum VarLocationIndex VarLocationIndex;
 
+typedef struct ShaderVars ShaderVars;
+
+struct ShaderVars {
+	GLuint dxLocation;
+	GLuint dyLocation;
+	GLuint zoomLocation;
+	GLuint rotationMatrixLocation;
+	GLuint destinationSizeLocation;
+	GLuint sourceSizeLocation;
+
+	// last values sent to the program
+	GLfloat dx;
+	GLfloat dy;
+	GLfloat zoom;
+	GLfloat rotationMatrix[4];
+	GLfloat destinationSize[2];
+	GLfloat sourceSize[2];
+};
+
+#define SHADER_UNIFORM_MAX_VALUES 16
+
+// uniform which can be fed by the user
+struct ShaderUniform {
+	char *name; // NULL if the slot of the table is empty
+	unsigned int hash;
+	GLenum type;
+	GLint location[2]; // by VarLocationIndex, -1 if the program does not use it
+
+	// last value fed, sent to a program when it is used
+	GLfloat value[SHADER_UNIFORM_MAX_VALUES];
+	bool dirty[2];
+};
+
+#define SHADER_CACHE_BUCKETS 64
+
+// program linking a vertex and a fragment shader, shared by the shaders built from the same sources
+struct ShaderProgram {
+	char *vert_source;
+	char *frag_source;
+	unsigned int hash;
+	unsigned int refcount;
+	ShaderProgram *next; // in its bucket of the cache
+
+	// 0 until the program is linked, programs of the default sources are linked when first drawn with
+	GLuint prog;
+	bool failed;
+	ShaderVars vars;
+	// uniforms are stored in the program, this shader is the last one which sent its own
+	const Shader *uniforms_owner;
+};
+
 struct Shader {
-	GLuint prog_color;
-	GLuint prog_tex;
-	GLuint vert;
-	GLuint frag_color;
-	GLuint frag_tex;
-
-	struct {
-		GLuint dxLocation;
-		GLuint dyLocation;
-		GLuint zoomLocation;
-		GLuint rotationMatrixLocation;
-		GLuint destinationSizeLocation;
-		GLuint sourceSizeLocation;
-	} vars[2];
-	int ref;
+	ShaderProgram *programs[2]; // by VarLocationIndex
 
+	// open addressing hash table of the uniforms, by name
+	ShaderUniform *uniforms;
+	unsigned int uniforms_capacity;
+	// some uniforms have to be sent to the program
+	bool dirty[2];
+	int ref;
 };
-Shader *shader_new(GLuint prog_color, GLuint prog_tex, GLuint vert, GLuint frag_color, GLuint frag_tex);
-void shader_free(Shader *s);
+ShaderProgram *shader_program_get(const char *vert_source, const char *frag_source, char **error);
+void shader_program_release(ShaderProgram *p);
+GLuint shader_use_program(Shader *s, VarLocationIndex index);
 
-void shader_feed(const Shader *s, const char* name, float value);
+Shader *shader_new(ShaderProgram *program_color, ShaderProgram *program_tex);
+void shader_free(Shader *s);
 
+int shader_feed(Shader *s, const char* name, const GLfloat *values, unsigned int count);
+void shader_upload_uniforms(Shader *s, VarLocationIndex index);
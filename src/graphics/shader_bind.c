@@ -16,6 +16,7 @@
  */
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdlib.h>
@@ -72,14 +73,77 @@ int mlua_use_default_shader(_unused_ lua_State* L)
 	return 0;
 }
 
+static unsigned int get_uniform_values(lua_State* L, int index, GLfloat values[SHADER_UNIFORM_MAX_VALUES])
+{
+	if (!lua_istable(L, index)) {
+		values[0] = luaL_checknumber(L, index);
+		return 1;
+	}
+
+	size_t count = lua_rawlen(L, index);
+	if (count < 1 || count > SHADER_UNIFORM_MAX_VALUES)
+		return luaL_error(L, "a uniform has between 1 and %d values", SHADER_UNIFORM_MAX_VALUES);
+	for (size_t i = 0; i < count; i++) {
+		lua_rawgeti(L, index, i + 1);
+		if (!lua_isnumber(L, -1))
+			return luaL_error(L, "values of a uniform must be numbers");
+		values[i] = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+	return count;
+}
+
+static void feed_shader(lua_State* L, Shader* shader, const char* name,
+                        const GLfloat *values, unsigned int count)
+{
+	int r = display_feed_shader(shader, name, values, count);
+	if (r == -ENOENT) {
+		log_warning("Cannot feed shader: no location for %s", name);
+	} else if (r == -EINVAL) {
+		luaL_error(L, "uniform %s does not have %d values", name, count);
+	}
+}
+
 int mlua_feed_shader(lua_State* L)
 {
 	assert(L);
 
 	Shader* shader = pop_shader(L, 1);
 	const char* name = luaL_checkstring(L, 2);
-	lua_Number value = luaL_checknumber(L, 3);
-	shader_feed(shader, name, value);
+	GLfloat values[SHADER_UNIFORM_MAX_VALUES];
+	unsigned int count;
+
+	if (lua_istable(L, 3)) {
+		count = get_uniform_values(L, 3, values);
+	} else {
+		int top = lua_gettop(L);
+		count = top - 2;
+		if (count < 1 || count > SHADER_UNIFORM_MAX_VALUES)
+			return luaL_error(L, "a uniform has between 1 and %d values", SHADER_UNIFORM_MAX_VALUES);
+		for (int i = 3; i <= top; i++)
+			values[i - 3] = luaL_checknumber(L, i);
+	}
+	feed_shader(L, shader, name, values, count);
+	return 0;
+}
+
+int mlua_feed_many_shader(lua_State* L)
+{
+	assert(L);
+
+	Shader* shader = pop_shader(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	GLfloat values[SHADER_UNIFORM_MAX_VALUES];
+
+	lua_pushnil(L);
+	while (lua_next(L, 2)) {
+		if (lua_type(L, -2) != LUA_TSTRING)
+			return luaL_error(L, "feed_many: names of the uniforms must be strings");
+		const char* name = lua_tostring(L, -2);
+		unsigned int count = get_uniform_values(L, lua_gettop(L), values);
+		feed_shader(L, shader, name, values, count);
+		lua_pop(L, 1);
+	}
 	return 0;
 }
 
@@ -22,6 +22,8 @@
 #include <png.h>
 
 #include "surface.h"
+#include "atlas.h"
+#include "texture_cache.h"
 #include "log.h"
 #include "util.h"
 #include "macro.h"
@@ -44,7 +46,7 @@ static int png_load(const char *filename, GLubyte **data, GLuint *width, GLuint
 
 	f = fopen(filename, "rb");
 	if (!f)
-		return -ENOENT;
+		return -errno;
 
 	r = fread(header, 1, sizeof(header), f);
 	if (r != sizeof(header)) {
@@ -175,6 +177,21 @@ static void surface_create_fbo(Surface *s)
 	s->has_fbo = true;
 }
 
+unsigned int surface_format_components(SurfaceFormat format)
+{
+	switch (format) {
+		case FORMAT_LUMINANCE:
+			return 1;
+		case FORMAT_LUMINANCE_ALPHA:
+			return 2;
+		case FORMAT_RGB:
+			return 3;
+		case FORMAT_RGBA:
+			return 4;
+	}
+	return 0;
+}
+
 Surface *surface_new(unsigned int w, unsigned int h, unsigned int texw, unsigned int texh,
 					 SurfaceFormat format, void *pixels, Surface *current_from, Surface *current_on)
 {
@@ -184,9 +201,10 @@ Surface *surface_new(unsigned int w, unsigned int h, unsigned int texw, unsigned
 	s->texw = texw;
 	s->texh = texh;
 	s->filter = FILTER_DEFAULT;
+	s->format = format;
 
 	glGenTextures(1, &(s->tex));
-	glBindTexture(GL_TEXTURE_2D, s->tex);
+	gl_bind_texture(s->tex);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, format, s->texw, s->texh,
 				 0, format, GL_UNSIGNED_BYTE, 0);
@@ -199,7 +217,7 @@ Surface *surface_new(unsigned int w, unsigned int h, unsigned int texw, unsigned
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	glBindTexture(GL_TEXTURE_2D, current_from ? current_from->tex : 0);
+	gl_bind_texture(current_from ? current_from->tex : 0);
 
 	if (!pixels) {
 		// we'll need a FBO anyway
@@ -223,20 +241,61 @@ void surface_free(Surface *s)
 
 	free(s->filename);
 	free(s->pixels);
+	free(s->stale_tiles);
+	free(s->dirty_tiles);
+
+	if (s->grid) {
+		for (unsigned int i = 0; i < s->grid_columns * s->grid_rows; i++)
+			surface_free(s->grid[i]);
+		free(s->grid);
+		free(s);
+		return;
+	}
 
-	glDeleteTextures(1, &(s->tex));
-	if (s->has_fbo) {
+	if (s->page) {
+		atlas_release(s->page);
+		free(s);
+		return;
+	}
+
+	gl_delete_texture(s->tex);
+	if (s->has_fbo && !s->backbuffer) {
 		glDeleteFramebuffers(1, &(s->fbo));
 	}
 	free(s);
 }
 
+void surface_attach_backbuffer(Surface *s)
+{
+	assert(s);
+	assert(!s->page);
+	assert(!s->backbuffer);
+
+	if (s->has_fbo)
+		glDeleteFramebuffers(1, &(s->fbo));
+	s->fbo = 0;
+	s->has_fbo = true;
+	s->backbuffer = true;
+	surface_mark_all_stale(s);
+}
+
+void surface_detach_backbuffer(Surface *s)
+{
+	assert(s);
+	assert(s->backbuffer);
+
+	// the fbo is created by the next surface_draw_on
+	s->fbo = 0;
+	s->has_fbo = false;
+	s->backbuffer = false;
+}
+
 void surface_draw_on(Surface *s)
 {
 	assert(s);
+	assert(!s->page);
 
 	s->has_mipmap = false;
-	s->pixels_valid = false;
 	if (!s->has_fbo) {
 		surface_create_fbo(s);
 		// We do not need to bind the fbo since it is done in create_fbo
@@ -249,7 +308,7 @@ void surface_draw_from(Surface *s)
 {
 	assert(s);
 
-	glBindTexture(GL_TEXTURE_2D, s->tex);
+	gl_bind_texture(s->tex);
 
 	if (!s->has_mipmap && s->filter >= FILTER_BILINEAR && !s->npot) {
 		glGenerateMipmap(GL_TEXTURE_2D);
@@ -267,7 +326,13 @@ void surface_set_filter(Surface *s, FilterMode new_filter, Surface *current_surf
 
 	s->filter = new_filter;
 
-	glBindTexture(GL_TEXTURE_2D, s->tex);
+	if (s->grid) {
+		for (unsigned int i = 0; i < s->grid_columns * s->grid_rows; i++)
+			surface_set_filter(s->grid[i], new_filter, current_surface);
+		return;
+	}
+
+	gl_bind_texture(s->tex);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, s->filter);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, s->filter > FILTER_LINEAR ? FILTER_LINEAR : s->filter);
@@ -278,10 +343,94 @@ void surface_set_filter(Surface *s, FilterMode new_filter, Surface *current_surf
 	}
 
 	if (s != current_surface) {
-		glBindTexture(GL_TEXTURE_2D, current_surface ? current_surface->tex : 0);
+		gl_bind_texture(current_surface ? current_surface->tex : 0);
 	}
 }
 
+static unsigned int surface_tile_rows(const Surface *s)
+{
+	return (s->h + (1u << s->tile_shift) - 1) >> s->tile_shift;
+}
+
+/**
+ * Allocates the CPU copy of the texture, entirely stale.
+ */
+static void surface_alloc_pixels(Surface *s)
+{
+	if (s->pixels)
+		return;
+
+	// a row of tiles must fit in 64 bits
+	s->tile_shift = 0;
+	while ((1u << s->tile_shift) < SURFACE_TILE_SIZE || (s->w >> s->tile_shift) >= 64)
+		s->tile_shift++;
+
+	s->pixels = new(unsigned char, s->w * s->h * 4);
+	s->stale_tiles = new0(uint64_t, surface_tile_rows(s));
+	s->dirty_tiles = new0(uint64_t, surface_tile_rows(s));
+	surface_mark_all_stale(s);
+}
+
+static void surface_mark_tiles(const Surface *s, uint64_t *tiles, int x0, int y0, int x1, int y1)
+{
+	int w = s->w;
+	int h = s->h;
+	x0 = MAX(x0, 0);
+	y0 = MAX(y0, 0);
+	x1 = MIN(x1, w);
+	y1 = MIN(y1, h);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	unsigned int tx0 = x0 >> s->tile_shift;
+	unsigned int tx1 = (x1 - 1) >> s->tile_shift;
+	uint64_t mask = (UINT64_MAX >> (63 - tx1)) & (UINT64_MAX << tx0);
+	for (unsigned int ty = y0 >> s->tile_shift; ty <= (unsigned int) (y1 - 1) >> s->tile_shift; ty++)
+		tiles[ty] |= mask;
+}
+
+/**
+ * Tells that the pixels in (x0, y0, x1, y1) (x1 and y1 excluded) may have changed
+ * on the GPU, so they have to be read back again.
+ */
+void surface_mark_stale(Surface *s, int x0, int y0, int x1, int y1)
+{
+	assert(s);
+
+	if (!s->pixels)
+		return;
+
+	surface_mark_tiles(s, s->stale_tiles, x0, y0, x1, y1);
+}
+
+void surface_mark_all_stale(Surface *s)
+{
+	assert(s);
+
+	surface_mark_stale(s, 0, 0, s->w, s->h);
+}
+
+/**
+ * Reads the rectangle (x, y, w, h) of the texture into 'dest', whose rows are 'stride' pixels long.
+ */
+static void surface_read_back(Surface *s, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+                              unsigned char *dest, unsigned int stride, Surface *current_on)
+{
+	surface_draw_on(s);
+	if (stride == w) {
+		glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, dest);
+	} else {
+		// GLES2 cannot read into rows of another size
+		unsigned char *tmp = new(unsigned char, w * h * 4);
+		glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, tmp);
+		for (unsigned int i = 0; i < h; i++)
+			memcpy(dest + i * stride * 4, tmp + i * w * 4, w * 4);
+		free(tmp);
+	}
+	GLDEBUG();
+	surface_draw_on(current_on);
+}
+
 void surface_get_pixel(Surface *s, unsigned int x, unsigned int y,
 					   int *red, int *green, int *blue, int *alpha, Surface *current_on)
 {
@@ -293,17 +442,30 @@ void surface_get_pixel(Surface *s, unsigned int x, unsigned int y,
 	assert(current_on);
 	assert(s != current_on);
 
-	if (!s->pixels_valid) {
-		surface_draw_on(s);
-		s->pixels_valid = true;
-
-		if (!s->pixels)
-			s->pixels = new(unsigned char, s->w * s->h * 4);
-
-		glReadPixels(0, 0, s->w, s->h, GL_RGBA, GL_UNSIGNED_BYTE, s->pixels);
-		GLDEBUG();
+	if (s->page) {
+		surface_get_pixel(s->page, x + s->page_x, y + s->page_y, red, green, blue, alpha, current_on);
+		return;
+	}
+	if (s->grid) {
+		unsigned int size = s->grid_cell_size;
+		Surface *cell = s->grid[x / size + y / size * s->grid_columns];
+		surface_get_pixel(cell, x % size, y % size, red, green, blue, alpha, current_on);
+		return;
+	}
 
-		surface_draw_on(current_on);
+	surface_alloc_pixels(s);
+
+	// only the tile of the pixel is read back
+	unsigned int tx = x >> s->tile_shift;
+	unsigned int ty = y >> s->tile_shift;
+	if (s->stale_tiles[ty] & ((uint64_t) 1 << tx)) {
+		unsigned int tile_x = tx << s->tile_shift;
+		unsigned int tile_y = ty << s->tile_shift;
+		unsigned int tile_w = MIN(1u << s->tile_shift, s->w - tile_x);
+		unsigned int tile_h = MIN(1u << s->tile_shift, s->h - tile_y);
+		surface_read_back(s, tile_x, tile_y, tile_w, tile_h,
+		                  s->pixels + (tile_x + tile_y * s->w) * 4, s->w, current_on);
+		s->stale_tiles[ty] &= ~((uint64_t) 1 << tx);
 	}
 
 	size_t idx = (x + y * s->w) * 4;
@@ -313,31 +475,347 @@ void surface_get_pixel(Surface *s, unsigned int x, unsigned int y,
 	*alpha = s->pixels[idx + 3];
 }
 
-int surface_load(const char *filename, Surface **surface, Surface *current_surface)
+/**
+ * Gathers the rectangle (x, y, w, h) of a grid surface from the cells it overlaps.
+ */
+static void surface_get_grid_pixels(Surface *s, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+                                    unsigned char *pixels, Surface *current_on)
+{
+	unsigned int size = s->grid_cell_size;
+
+	for (unsigned int row = y / size; row <= (y + h - 1) / size; row++) {
+		for (unsigned int column = x / size; column <= (x + w - 1) / size; column++) {
+			Surface *cell = s->grid[column + row * s->grid_columns];
+			unsigned int cell_x = column * size;
+			unsigned int cell_y = row * size;
+			unsigned int x0 = MAX(x, cell_x);
+			unsigned int y0 = MAX(y, cell_y);
+			unsigned int part_w = MIN(x + w, cell_x + cell->w) - x0;
+			unsigned int part_h = MIN(y + h, cell_y + cell->h) - y0;
+			unsigned char *part = new(unsigned char, part_w * part_h * 4);
+
+			surface_get_pixels(cell, x0 - cell_x, y0 - cell_y, part_w, part_h, part, current_on);
+			for (unsigned int j = 0; j < part_h; j++)
+				memcpy(pixels + ((x0 - x) + (y0 - y + j) * w) * 4, part + j * part_w * 4, part_w * 4);
+			free(part);
+		}
+	}
+}
+
+/**
+ * Copies the RGBA pixels of the rectangle (x, y, w, h) into 'pixels', which holds w * h * 4 bytes.
+ * The texture is read back only if the rectangle was drawn on since the last read back,
+ * and then only the rectangle is read.
+ */
+void surface_get_pixels(Surface *s, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+                        unsigned char *pixels, Surface *current_on)
+{
+	assert(s);
+	assert(pixels);
+	assert(current_on);
+	assert(s != current_on);
+	assert(w > 0 && h > 0);
+	assert(x + w <= s->w);
+	assert(y + h <= s->h);
+
+	if (s->page) {
+		surface_get_pixels(s->page, x + s->page_x, y + s->page_y, w, h, pixels, current_on);
+		return;
+	}
+	if (s->grid) {
+		surface_get_grid_pixels(s, x, y, w, h, pixels, current_on);
+		return;
+	}
+
+	surface_alloc_pixels(s);
+
+	unsigned int shift = s->tile_shift;
+	unsigned int tx0 = x >> shift;
+	unsigned int tx1 = (x + w - 1) >> shift;
+	unsigned int ty0 = y >> shift;
+	unsigned int ty1 = (y + h - 1) >> shift;
+	uint64_t mask = (UINT64_MAX >> (63 - tx1)) & (UINT64_MAX << tx0);
+	bool stale = false;
+	for (unsigned int ty = ty0; ty <= ty1; ty++)
+		stale |= (s->stale_tiles[ty] & mask) != 0;
+
+	if (!stale) {
+		for (unsigned int i = 0; i < h; i++)
+			memcpy(pixels + i * w * 4, s->pixels + (x + (y + i) * s->w) * 4, w * 4);
+		return;
+	}
+
+	surface_read_back(s, x, y, w, h, pixels, w, current_on);
+	for (unsigned int i = 0; i < h; i++)
+		memcpy(s->pixels + (x + (y + i) * s->w) * 4, pixels + i * w * 4, w * 4);
+
+	// tiles entirely covered by the rectangle are now up to date
+	unsigned int x1 = x + w;
+	unsigned int y1 = y + h;
+	unsigned int ftx0 = (x + (1u << shift) - 1) >> shift;
+	unsigned int fty0 = (y + (1u << shift) - 1) >> shift;
+	unsigned int ftx1 = x1 == s->w ? tx1 + 1 : x1 >> shift;
+	unsigned int fty1 = y1 == s->h ? ty1 + 1 : y1 >> shift;
+	if (ftx0 < ftx1) {
+		uint64_t full = (UINT64_MAX >> (64 - ftx1)) & (UINT64_MAX << ftx0);
+		for (unsigned int ty = fty0; ty < fty1; ty++)
+			s->stale_tiles[ty] &= ~full;
+	}
+}
+
+/**
+ * Calls 'callback' for each horizontal run of tiles set in 'tiles', with the rectangle
+ * of pixels it covers (clipped to the surface).
+ */
+static void surface_foreach_tile_run(Surface *s, const uint64_t *tiles,
+                                     void (*callback)(Surface *s, unsigned int x, unsigned int y,
+                                                      unsigned int w, unsigned int h, void *arg),
+                                     void *arg)
+{
+	unsigned int size = 1u << s->tile_shift;
+
+	for (unsigned int ty = 0; ty < surface_tile_rows(s); ty++) {
+		uint64_t mask = tiles[ty];
+		unsigned int tx = 0;
+		while (mask) {
+			while (!(mask & 1)) {
+				mask >>= 1;
+				tx++;
+			}
+			unsigned int run = 0;
+			while (mask & 1) {
+				mask >>= 1;
+				run++;
+			}
+			unsigned int x = tx * size;
+			unsigned int y = ty * size;
+			callback(s, x, y, MIN(run * size, s->w - x), MIN(size, s->h - y), arg);
+			tx += run;
+		}
+	}
+}
+
+static void surface_read_back_run(Surface *s, unsigned int x, unsigned int y, unsigned int w, unsigned int h, void *arg)
+{
+	surface_read_back(s, x, y, w, h, s->pixels + (x + y * s->w) * 4, s->w, arg);
+}
+
+/**
+ * Makes the CPU copy of the surface entirely up to date, so the game can modify it.
+ * The modifications are sent to the texture by surface_unlock.
+ */
+void surface_lock(Surface *s, Surface *current_on)
+{
+	assert(s);
+	assert(!s->page);
+	assert(!s->locked);
+	assert(s != current_on);
+
+	surface_alloc_pixels(s);
+	surface_foreach_tile_run(s, s->stale_tiles, surface_read_back_run, current_on);
+	memset(s->stale_tiles, 0, surface_tile_rows(s) * sizeof(uint64_t));
+	s->locked = true;
+}
+
+void surface_mark_modified(Surface *s, int x0, int y0, int x1, int y1)
+{
+	assert(s);
+	assert(s->locked);
+
+	surface_mark_tiles(s, s->dirty_tiles, x0, y0, x1, y1);
+}
+
+static void surface_upload_run(Surface *s, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+                               _unused_ void *arg)
+{
+	unsigned int components = surface_format_components(s->format);
+
+	if (components == 4 && w == s->w) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, s->pixels + y * s->w * 4);
+		return;
+	}
+
+	// GLES2 cannot upload rows of another size, and the texture may not be RGBA
+	unsigned char *tmp = new(unsigned char, w * h * components);
+	unsigned char *dst = tmp;
+	for (unsigned int j = 0; j < h; j++) {
+		const unsigned char *src = s->pixels + (x + (y + j) * s->w) * 4;
+		for (unsigned int i = 0; i < w; i++, src += 4, dst += components) {
+			if (components == 1 || components == 2) {
+				dst[0] = src[0];
+				if (components == 2)
+					dst[1] = src[3];
+			} else {
+				memcpy(dst, src, components);
+			}
+		}
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, s->format, GL_UNSIGNED_BYTE, tmp);
+	free(tmp);
+}
+
+/**
+ * Uploads the modified tiles of the CPU copy to the texture.
+ */
+void surface_unlock(Surface *s, Surface *current_from)
+{
+	assert(s);
+	assert(s->locked);
+
+	gl_bind_texture(s->tex);
+	surface_foreach_tile_run(s, s->dirty_tiles, surface_upload_run, NULL);
+	gl_bind_texture(current_from ? current_from->tex : 0);
+	GLDEBUG();
+
+	memset(s->dirty_tiles, 0, surface_tile_rows(s) * sizeof(uint64_t));
+	s->has_mipmap = false;
+	s->locked = false;
+}
+
+int surface_decode(const char *filename, SurfaceImage *image)
 {
 	assert(filename);
-	assert(surface);
+	assert(image);
 
-	GLuint w, h;
-	SurfaceFormat format;
 	GLint internal_format;
-	GLubyte *data;
 	int r;
 
-	r = png_load(filename, &data, &w, &h, &format, &internal_format);
+	if (texture_cache_load(filename, image) >= 0)
+		return 0;
+
+	image->mapping = NULL;
+	image->mapping_size = 0;
+	r = png_load(filename, &image->data, &image->w, &image->h, &image->format, &internal_format);
 	if (r < 0)
 		return r;
-	if (w <= 0 || w > 2048 || h <= 0 || h > 2048) {
-		free(data);
+	if (image->w <= 0 || image->w > SURFACE_MAX_IMAGE_SIZE || image->h <= 0 || image->h > SURFACE_MAX_IMAGE_SIZE) {
+		free(image->data);
+		image->data = NULL;
 		return -E2BIG;
 	}
+	image->texw = image->w;
+	image->texh = image->h;
+
+	r = texture_cache_store(filename, image);
+	if (r < 0 && r != -ENOENT)
+		log_warning("Cannot store '%s' in the texture cache: %s", filename, strerror(-r));
+
+	return 0;
+}
+
+void surface_image_free(SurfaceImage *image)
+{
+	assert(image);
+
+	if (image->mapping)
+		texture_cache_unmap(image);
+	else
+		free(image->data);
+	image->data = NULL;
+}
+
+static GLuint surface_grid_cell_size(void)
+{
+	static GLint max_texture_size;
+
+	if (!max_texture_size)
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+	if (max_texture_size <= 0)
+		return SURFACE_MAX_TEXTURE_SIZE;
+	return MIN((GLuint) max_texture_size, (GLuint) SURFACE_MAX_TEXTURE_SIZE);
+}
+
+/**
+ * Splits an image too large for a single texture in a grid of cells.
+ * The cells are not padded to a power of two, so the last column and row do not waste memory,
+ * but the surface cannot have mipmaps.
+ */
+static Surface *surface_new_grid(const SurfaceImage *image, GLuint cell_size, Surface *current_from)
+{
+	unsigned int components = surface_format_components(image->format);
+	Surface *s = new0(Surface, 1);
+	s->w = image->w;
+	s->h = image->h;
+	s->texw = image->w;
+	s->texh = image->h;
+	s->filter = FILTER_DEFAULT;
+	s->format = image->format;
+	s->npot = true;
+	s->grid_cell_size = cell_size;
+	s->grid_columns = (s->w + cell_size - 1) / cell_size;
+	s->grid_rows = (s->h + cell_size - 1) / cell_size;
+	s->grid = new(Surface *, s->grid_columns * s->grid_rows);
+
+	// GLES2 cannot upload a part of the rows, so each cell is copied first
+	unsigned char *pixels = new(unsigned char, cell_size * cell_size * components);
+	for (unsigned int row = 0; row < s->grid_rows; row++) {
+		for (unsigned int column = 0; column < s->grid_columns; column++) {
+			unsigned int x = column * cell_size;
+			unsigned int y = row * cell_size;
+			unsigned int w = MIN(cell_size, s->w - x);
+			unsigned int h = MIN(cell_size, s->h - y);
+
+			for (unsigned int j = 0; j < h; j++)
+				memcpy(pixels + j * w * components,
+				       image->data + (x + (y + j) * image->texw) * components, w * components);
+			Surface *cell = surface_new(w, h, w, h, image->format, pixels, current_from, NULL);
+			cell->npot = true;
+			s->grid[column + row * s->grid_columns] = cell;
+		}
+	}
+	free(pixels);
+
+	return s;
+}
+
+Surface *surface_upload(const char *filename, const SurfaceImage *image, bool atlas, Surface *current_from, Surface *current_on)
+{
+	assert(filename);
+	assert(image);
+	assert(image->data);
+
+	GLuint w = image->w;
+	GLuint h = image->h;
+	GLuint cell_size = surface_grid_cell_size();
+	Surface *surface;
+
+	if (w > cell_size || h > cell_size) {
+		surface = surface_new_grid(image, cell_size, current_from);
+	} else if (atlas && w <= ATLAS_MAX_SURFACE_SIZE && h <= ATLAS_MAX_SURFACE_SIZE) {
+		surface = atlas_add(w, h, image->format, image->data, image->texw, current_from, current_on);
+	} else {
+		GLuint potw = pow(2, (int) ceil(log(w) / log(2)));
+		GLuint poth = pow(2, (int) ceil(log(h) / log(2)));
+		if (image->texw == potw && image->texh == poth) {
+			// already padded, upload the whole texture at once
+			surface = surface_new(potw, poth, potw, poth, image->format, image->data, current_from, NULL);
+			surface->w = w;
+			surface->h = h;
+		} else {
+			assert(image->texw == w);
+			surface = surface_new(w, h, potw, poth, image->format, image->data, current_from, NULL);
+		}
+	}
+	surface->filename = xstrdup(filename);
+
+	return surface;
+}
+
+int surface_load(const char *filename, Surface **surface, bool atlas, Surface *current_from, Surface *current_on)
+{
+	assert(filename);
+	assert(surface);
+
+	SurfaceImage image;
+	int r;
+
+	r = surface_decode(filename, &image);
+	if (r < 0)
+		return r;
 
-	GLuint potw = pow(2, (int) ceil(log(w) / log(2)));
-	GLuint poth = pow(2, (int) ceil(log(h) / log(2)));
-	*surface = surface_new(w, h, potw, poth, format, data, current_surface, NULL);
-	(*surface)->filename = xstrdup(filename);
+	*surface = surface_upload(filename, &image, atlas, current_from, current_on);
 
-	free(data);
+	surface_image_free(&image);
 	return 0;
 }
 
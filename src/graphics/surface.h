@@ -18,6 +18,8 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifndef EMSCRIPTEN
 #include <SDL2/SDL_opengles2.h>
@@ -26,6 +28,7 @@
 #endif
 
 typedef struct Surface Surface;
+typedef struct SurfaceImage SurfaceImage;
 
 enum FilterMode {
 	FILTER_NEAREST = GL_NEAREST,
@@ -45,6 +48,29 @@ enum SurfaceFormat {
 };
 typedef enum SurfaceFormat SurfaceFormat;
 
+// decoded pixels of an image file, not yet uploaded to a texture
+struct SurfaceImage {
+	GLubyte *data;
+	GLuint w;
+	GLuint h;
+	// size of the rows and columns of 'data', bigger than w and h if the pixels are already padded
+	GLuint texw;
+	GLuint texh;
+	SurfaceFormat format;
+
+	// if set, 'data' lies in a mapped texture cache file instead of being allocated
+	void *mapping;
+	size_t mapping_size;
+};
+
+// largest texture created for a surface, bigger images are split in a grid of textures
+#define SURFACE_MAX_TEXTURE_SIZE 2048
+// largest image which can be loaded
+#define SURFACE_MAX_IMAGE_SIZE 16384
+
+// size of the tiles in which the CPU copy of a surface is tracked (if the surface is not too large)
+#define SURFACE_TILE_SIZE 64
+
 struct Surface {
 	char* filename;
 	unsigned int w;
@@ -52,6 +78,7 @@ struct Surface {
 	unsigned int texw;
 	unsigned int texh;
 	FilterMode filter;
+	SurfaceFormat format;
 	bool has_fbo;
 	bool has_mipmap;
 	bool npot;
@@ -60,8 +87,31 @@ struct Surface {
 	GLuint tex;
 	GLuint fbo;
 
+	// copy of the texture read back by get_pixel(s)
 	unsigned char *pixels;
-	bool pixels_valid;
+	// one bit per tile of 'pixels' which may differ from the texture, a mask of 64 tiles per row of tiles
+	uint64_t *stale_tiles;
+	// tiles are (1 << tile_shift) pixels wide, at least SURFACE_TILE_SIZE
+	unsigned int tile_shift;
+	// if set, 'pixels' is modified by the game and 'dirty_tiles' are uploaded on unlock
+	bool locked;
+	uint64_t *dirty_tiles;
+
+	// if set, the surface is packed in an atlas page and shares its texture
+	Surface *page;
+	unsigned int page_x;
+	unsigned int page_y;
+
+	// if set, the image is too large for a single texture and is split in
+	// grid_columns * grid_rows surfaces of grid_cell_size pixels (less on the last column and row)
+	Surface **grid;
+	unsigned int grid_columns;
+	unsigned int grid_rows;
+	unsigned int grid_cell_size;
+
+	// if set, drawing on the surface goes to the default framebuffer (reversed vertically)
+	// and its texture is not up to date
+	bool backbuffer;
 };
 
 Surface *surface_new(unsigned int w,
@@ -73,11 +123,29 @@ Surface *surface_new(unsigned int w,
                      Surface *current_from,
                      Surface *current_on);
 void surface_free(Surface *s);
+unsigned int surface_format_components(SurfaceFormat format);
+void surface_attach_backbuffer(Surface *s);
+void surface_detach_backbuffer(Surface *s);
 void surface_draw_on(Surface *s);
 void surface_draw_from(Surface *s);
 void surface_set_filter(Surface *s, FilterMode filter, Surface *current_surface);
 void surface_get_pixel(Surface *s, unsigned int x, unsigned int y,
 		       int *red, int *green, int *blue, int *alpha, Surface *current_on);
+void surface_get_pixels(Surface *s, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+                        unsigned char *pixels, Surface *current_on);
+void surface_mark_stale(Surface *s, int x0, int y0, int x1, int y1);
+void surface_mark_all_stale(Surface *s);
+void surface_lock(Surface *s, Surface *current_on);
+void surface_mark_modified(Surface *s, int x0, int y0, int x1, int y1);
+void surface_unlock(Surface *s, Surface *current_from);
+
+// surface owning the texture (and the mipmaps, the filter, ...) of the surface
+static inline Surface *surface_get_texture_owner(Surface *s)
+{
+	assert(s);
+
+	return s->page ? s->page : s;
+}
 
 static inline void surface_get_size(const Surface *s, unsigned int *w, unsigned int *h)
 {
@@ -87,5 +155,8 @@ static inline void surface_get_size(const Surface *s, unsigned int *w, unsigned
 	*h = s->h;
 }
 
-int surface_load(const char* filename, Surface **surface, Surface *current_surface);
+int surface_decode(const char *filename, SurfaceImage *image);
+void surface_image_free(SurfaceImage *image);
+Surface *surface_upload(const char *filename, const SurfaceImage *image, bool atlas, Surface *current_from, Surface *current_on);
+int surface_load(const char* filename, Surface **surface, bool atlas, Surface *current_from, Surface *current_on);
 
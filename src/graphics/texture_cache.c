@@ -0,0 +1,338 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifndef EMSCRIPTEN
+#include <pthread.h>
+#endif
+
+#include "texture_cache.h"
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+
+log_category("texcache");
+
+static struct {
+	char *directory;
+#ifndef EMSCRIPTEN
+	// the directory is read by the loading thread
+	pthread_mutex_t mutex;
+#endif
+} cache = {
+	.directory = NULL,
+#ifndef EMSCRIPTEN
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+static const char *normalize_filename(const char *filename)
+{
+	while (startswith(filename, "./"))
+		filename += 2;
+	return filename;
+}
+
+static uint64_t hash_filename(const char *filename)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char *c = filename; *c; c++) {
+		hash ^= (unsigned char) *c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Returns the path of the cache entry of 'filename', or NULL if there is no cache directory.
+ */
+static char *texture_cache_path(const char *filename)
+{
+	char name[17 + sizeof(TEXTURE_CACHE_EXTENSION)];
+	char *path = NULL;
+
+	snprintf(name, sizeof(name), "%016" PRIx64 TEXTURE_CACHE_EXTENSION, hash_filename(filename));
+
+#ifndef EMSCRIPTEN
+	pthread_mutex_lock(&cache.mutex);
+#endif
+	if (cache.directory)
+		path = strjoin(cache.directory, "/", name, NULL);
+#ifndef EMSCRIPTEN
+	pthread_mutex_unlock(&cache.mutex);
+#endif
+
+	return path;
+}
+
+static size_t data_offset(uint32_t path_length)
+{
+	return (sizeof(struct TextureCacheHeader) + path_length + 15) & ~(size_t) 15;
+}
+
+static uint32_t next_power_of_two(uint32_t x)
+{
+	uint32_t pot = 1;
+	while (pot < x)
+		pot <<= 1;
+	return pot;
+}
+
+/**
+ * Images small enough for one texture are padded to power of two sizes so they are
+ * uploaded at once, images split in a grid of textures are not padded.
+ */
+static void padded_size(uint32_t w, uint32_t h, uint32_t *texw, uint32_t *texh)
+{
+	if (w > SURFACE_MAX_TEXTURE_SIZE || h > SURFACE_MAX_TEXTURE_SIZE) {
+		*texw = w;
+		*texh = h;
+	} else {
+		*texw = next_power_of_two(w);
+		*texh = next_power_of_two(h);
+	}
+}
+
+int texture_cache_set_directory(const char *directory)
+{
+	char *old;
+	char *new_directory = NULL;
+	int r;
+
+	if (directory) {
+		// mkdir_p only creates the parents of the last component
+		char *path = strjoin(directory, "/", NULL);
+		r = mkdir_p(path);
+		free(path);
+		if (r < 0)
+			return r;
+		new_directory = xstrdup(directory);
+	}
+
+#ifndef EMSCRIPTEN
+	pthread_mutex_lock(&cache.mutex);
+#endif
+	old = cache.directory;
+	cache.directory = new_directory;
+#ifndef EMSCRIPTEN
+	pthread_mutex_unlock(&cache.mutex);
+#endif
+	free(old);
+
+	return 0;
+}
+
+static bool header_is_valid(const struct TextureCacheHeader *header, size_t size,
+                            const char *filename, const struct stat *source)
+{
+	if (memcmp(header->magic, TEXTURE_CACHE_MAGIC, sizeof(header->magic)))
+		return false;
+	if (header->source_mtime != (int64_t) source->st_mtime || header->source_size != (uint64_t) source->st_size)
+		return false;
+	if (header->path_length != strlen(filename) || data_offset(header->path_length) > size)
+		return false;
+	if (memcmp((const char *) (header + 1), filename, header->path_length))
+		return false;
+	if (header->w == 0 || header->w > SURFACE_MAX_IMAGE_SIZE || header->h == 0 || header->h > SURFACE_MAX_IMAGE_SIZE)
+		return false;
+	// surface_upload only knows the padding written by texture_cache_write
+	uint32_t texw, texh;
+	padded_size(header->w, header->h, &texw, &texh);
+	if (header->texw != texw || header->texh != texh)
+		return false;
+
+	unsigned int components = surface_format_components(header->format);
+	if (!components)
+		return false;
+	if (size - data_offset(header->path_length) < (size_t) header->texw * header->texh * components)
+		return false;
+	return true;
+}
+
+/**
+ * Maps the cache entry of 'filename' if it is up to date.
+ * Returns -ENOENT if there is no cache directory or no entry, -ESTALE if the entry is outdated or corrupted.
+ */
+int texture_cache_load(const char *filename, SurfaceImage *image)
+{
+	assert(filename);
+	assert(image);
+
+	struct stat source;
+	unsigned char *data;
+	long size;
+	char *path;
+	FILE *file;
+
+	filename = normalize_filename(filename);
+	path = texture_cache_path(filename);
+	if (!path)
+		return -ENOENT;
+
+	if (stat(filename, &source) < 0) {
+		free(path);
+		return -errno;
+	}
+
+	file = fopen(path, "rb");
+	free(path);
+	if (!file)
+		return -errno;
+
+	fseek(file, 0L, SEEK_END);
+	size = ftell(file);
+	if (size < (long) sizeof(struct TextureCacheHeader)) {
+		fclose(file);
+		return -ESTALE;
+	}
+	fseek(file, 0L, SEEK_SET);
+
+	data = mmap(0, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	fclose(file);
+	if (data == MAP_FAILED)
+		return -errno;
+
+	const struct TextureCacheHeader *header = (const struct TextureCacheHeader *) data;
+	if (!header_is_valid(header, size, filename, &source)) {
+		munmap(data, size);
+		return -ESTALE;
+	}
+
+	image->data = data + data_offset(header->path_length);
+	image->w = header->w;
+	image->h = header->h;
+	image->texw = header->texw;
+	image->texh = header->texh;
+	image->format = header->format;
+	image->mapping = data;
+	image->mapping_size = size;
+
+	return 0;
+}
+
+void texture_cache_unmap(SurfaceImage *image)
+{
+	assert(image);
+	assert(image->mapping);
+
+	munmap(image->mapping, image->mapping_size);
+	image->mapping = NULL;
+	image->mapping_size = 0;
+	image->data = NULL;
+}
+
+static int texture_cache_write(FILE *file, const char *filename, const struct stat *source, const SurfaceImage *image)
+{
+	struct TextureCacheHeader header;
+	unsigned int components = surface_format_components(image->format);
+	size_t row_size = (size_t) image->w * components;
+	size_t padded_row_size;
+	unsigned char *zeros;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+	header.source_mtime = source->st_mtime;
+	header.source_size = source->st_size;
+	header.w = image->w;
+	header.h = image->h;
+	padded_size(image->w, image->h, &header.texw, &header.texh);
+	header.format = image->format;
+	header.path_length = strlen(filename);
+
+	padded_row_size = (size_t) header.texw * components;
+	zeros = new0(unsigned char, MAX(padded_row_size, (size_t) 16));
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(filename, 1, header.path_length, file);
+	fwrite(zeros, 1, data_offset(header.path_length) - sizeof(header) - header.path_length, file);
+	for (unsigned int y = 0; y < header.texh; y++) {
+		if (y < image->h) {
+			fwrite(image->data + y * image->texw * components, 1, row_size, file);
+			fwrite(zeros, 1, padded_row_size - row_size, file);
+		} else {
+			fwrite(zeros, 1, padded_row_size, file);
+		}
+	}
+	free(zeros);
+
+	return ferror(file) ? -EIO : 0;
+}
+
+/**
+ * Writes the decoded pixels of 'filename' in the cache, padded to power of two sizes
+ * unless the image is split in a grid of textures.
+ * Returns -ENOENT if there is no cache directory.
+ */
+int texture_cache_store(const char *filename, const SurfaceImage *image)
+{
+	assert(filename);
+	assert(image);
+	assert(image->data);
+
+	struct stat source;
+	char *path;
+	char *tmp_path;
+	FILE *file;
+	int fd;
+	int r;
+
+	filename = normalize_filename(filename);
+	path = texture_cache_path(filename);
+	if (!path)
+		return -ENOENT;
+
+	if (stat(filename, &source) < 0) {
+		free(path);
+		return -errno;
+	}
+
+	// write in a temporary file first, so a concurrent load never sees a partial entry
+	tmp_path = strjoin(path, ".XXXXXX", NULL);
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		r = -errno;
+		goto out;
+	}
+	file = fdopen(fd, "wb");
+	if (!file) {
+		r = -errno;
+		close(fd);
+		unlink(tmp_path);
+		goto out;
+	}
+
+	r = texture_cache_write(file, filename, &source, image);
+	if (fclose(file) && r >= 0)
+		r = -errno;
+	if (r >= 0 && rename(tmp_path, path) < 0)
+		r = -errno;
+	if (r < 0)
+		unlink(tmp_path);
+
+out:
+	free(tmp_path);
+	free(path);
+	return r;
+}
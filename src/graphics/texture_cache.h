@@ -0,0 +1,48 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "surface.h"
+
+#define TEXTURE_CACHE_MAGIC "DRYTEX1"
+#define TEXTURE_CACHE_EXTENSION ".tex"
+
+/**
+ * A cache file starts with this header, followed by the path of the source
+ * image (path_length bytes), then by the pixels padded to texw x texh,
+ * starting at the next multiple of 16 bytes.
+ * The fields are in the native byte order, the cache is not portable between machines.
+ */
+struct TextureCacheHeader {
+	char magic[8];
+	// of the source image, the entry is stale if they changed
+	int64_t source_mtime;
+	uint64_t source_size;
+	uint32_t w;
+	uint32_t h;
+	uint32_t texw;
+	uint32_t texh;
+	uint32_t format;
+	uint32_t path_length;
+};
+
+int texture_cache_set_directory(const char *directory);
+int texture_cache_load(const char *filename, SurfaceImage *image);
+int texture_cache_store(const char *filename, const SurfaceImage *image);
+void texture_cache_unmap(SurfaceImage *image);
@@ -0,0 +1,164 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdlib.h>
+
+#include "tilemap.h"
+#include "buffer.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+log_category("tilemap");
+
+Tilemap *tilemap_new(Surface *tileset, unsigned int tile_w, unsigned int tile_h, unsigned int w, unsigned int h)
+{
+	assert(tileset);
+	assert(tile_w > 0 && tile_w <= tileset->w);
+	assert(tile_h > 0 && tile_h <= tileset->h);
+	assert(w > 0);
+	assert(h > 0);
+
+	Tilemap *t = new0(Tilemap, 1);
+	t->tileset = tileset;
+	t->tile_w = tile_w;
+	t->tile_h = tile_h;
+	t->tileset_columns = tileset->w / tile_w;
+	t->num_tiles = MIN(t->tileset_columns * (tileset->h / tile_h), (unsigned int) TILEMAP_MAX_TILE);
+	t->w = w;
+	t->h = h;
+	t->tiles = new0(uint16_t, (size_t) w * h);
+	t->chunks_x = (w + TILEMAP_CHUNK_SIZE - 1) / TILEMAP_CHUNK_SIZE;
+	t->chunks_y = (h + TILEMAP_CHUNK_SIZE - 1) / TILEMAP_CHUNK_SIZE;
+	t->chunks = new0(TilemapChunk, t->chunks_x * t->chunks_y);
+
+	return t;
+}
+
+void tilemap_free(Tilemap *t)
+{
+	if (!t)
+		return;
+
+	for (unsigned int i = 0; i < t->chunks_x * t->chunks_y; i++)
+		buffer_free(t->chunks[i].buffer);
+	free(t->chunks);
+	free(t->tiles);
+	free(t);
+}
+
+void tilemap_set(Tilemap *t, unsigned int x, unsigned int y, uint16_t tile)
+{
+	assert(t);
+	assert(x < t->w);
+	assert(y < t->h);
+	assert(tile <= t->num_tiles);
+
+	uint16_t *current = t->tiles + x + y * t->w;
+	if (*current == tile)
+		return;
+
+	*current = tile;
+	t->chunks[x / TILEMAP_CHUNK_SIZE + y / TILEMAP_CHUNK_SIZE * t->chunks_x].dirty = true;
+}
+
+void tilemap_fill(Tilemap *t, unsigned int x, unsigned int y, unsigned int w, unsigned int h, uint16_t tile)
+{
+	assert(t);
+	assert(x + w <= t->w);
+	assert(y + h <= t->h);
+
+	for (unsigned int j = y; j < y + h; j++) {
+		for (unsigned int i = x; i < x + w; i++) {
+			tilemap_set(t, i, j, tile);
+		}
+	}
+}
+
+/**
+ * Builds the quads of the non empty tiles of a chunk in a new user buffer,
+ * which keeps only its VBO once uploaded.
+ */
+static void tilemap_bake_chunk(Tilemap *t, unsigned int cx, unsigned int cy)
+{
+	TilemapChunk *chunk = t->chunks + cx + cy * t->chunks_x;
+	unsigned int x0 = cx * TILEMAP_CHUNK_SIZE;
+	unsigned int y0 = cy * TILEMAP_CHUNK_SIZE;
+	unsigned int x1 = MIN(x0 + TILEMAP_CHUNK_SIZE, t->w);
+	unsigned int y1 = MIN(y0 + TILEMAP_CHUNK_SIZE, t->h);
+	unsigned int count = 0;
+
+	buffer_free(chunk->buffer);
+	chunk->buffer = NULL;
+	chunk->dirty = false;
+
+	for (unsigned int y = y0; y < y1; y++) {
+		for (unsigned int x = x0; x < x1; x++) {
+			count += tilemap_get(t, x, y) != 0;
+		}
+	}
+	if (!count)
+		return;
+
+	Buffer *b = buffer_new(true, count * 4);
+	buffer_allocate(b);
+	b->has_texture = true;
+	// the color is given when the chunk is drawn
+	b->constant_color = true;
+
+	// position of the tileset in its atlas page (0 if not packed)
+	float ox = t->tileset->page_x;
+	float oy = t->tileset->page_y;
+	float tw = t->tile_w;
+	float th = t->tile_h;
+	for (unsigned int y = y0; y < y1; y++) {
+		for (unsigned int x = x0; x < x1; x++) {
+			uint16_t tile = tilemap_get(t, x, y);
+			if (!tile)
+				continue;
+
+			float sx = ox + (tile - 1) % t->tileset_columns * tw;
+			float sy = oy + (tile - 1) / t->tileset_columns * th;
+			float dx = x * tw;
+			float dy = y * th;
+			buffer_push_vertex(b, dx, dy, 255, 255, 255, 255, sx, sy);
+			buffer_push_vertex(b, dx + tw, dy, 255, 255, 255, 255, sx + tw, sy);
+			buffer_push_vertex(b, dx + tw, dy + th, 255, 255, 255, 255, sx + tw, sy + th);
+			buffer_push_vertex(b, dx, dy + th, 255, 255, 255, 255, sx, sy + th);
+		}
+	}
+	buffer_upload_and_free(b);
+	chunk->buffer = b;
+
+	log_debug("chunk %u,%u baked with %u tiles", cx, cy, count);
+}
+
+/**
+ * Returns the buffer of the chunk (cx, cy), baked again if a tile changed since it was drawn,
+ * or NULL if the chunk is empty.
+ */
+Buffer *tilemap_get_chunk(Tilemap *t, unsigned int cx, unsigned int cy)
+{
+	assert(t);
+	assert(cx < t->chunks_x);
+	assert(cy < t->chunks_y);
+
+	TilemapChunk *chunk = t->chunks + cx + cy * t->chunks_x;
+	if (chunk->dirty)
+		tilemap_bake_chunk(t, cx, cy);
+	return chunk->buffer;
+}
@@ -0,0 +1,72 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "surface.h"
+
+// width and height of the chunks of a tilemap, in tiles
+#define TILEMAP_CHUNK_SIZE 32
+// a tile is an index in the tileset stored on 16 bits
+#define TILEMAP_MAX_TILE UINT16_MAX
+
+typedef struct Tilemap Tilemap;
+typedef struct TilemapChunk TilemapChunk;
+
+struct TilemapChunk {
+	// quads of the non empty tiles, uploaded once; NULL if the chunk is empty
+	Buffer *buffer;
+	// if set, the buffer is baked again before being drawn
+	bool dirty;
+};
+
+struct Tilemap {
+	Surface *tileset;
+	unsigned int tile_w;
+	unsigned int tile_h;
+	// the tiles of the tileset are numbered from 1, row after row
+	unsigned int tileset_columns;
+	unsigned int num_tiles;
+
+	// size of the map, in tiles
+	unsigned int w;
+	unsigned int h;
+	// index of each tile in the tileset, 0 if the tile is empty
+	uint16_t *tiles;
+
+	unsigned int chunks_x;
+	unsigned int chunks_y;
+	TilemapChunk *chunks;
+};
+
+Tilemap *tilemap_new(Surface *tileset, unsigned int tile_w, unsigned int tile_h, unsigned int w, unsigned int h);
+void tilemap_free(Tilemap *t);
+void tilemap_set(Tilemap *t, unsigned int x, unsigned int y, uint16_t tile);
+void tilemap_fill(Tilemap *t, unsigned int x, unsigned int y, unsigned int w, unsigned int h, uint16_t tile);
+Buffer *tilemap_get_chunk(Tilemap *t, unsigned int cx, unsigned int cy);
+
+static inline uint16_t tilemap_get(const Tilemap *t, unsigned int x, unsigned int y)
+{
+	assert(t);
+	assert(x < t->w);
+	assert(y < t->h);
+
+	return t->tiles[x + y * t->w];
+}
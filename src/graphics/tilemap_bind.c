@@ -0,0 +1,167 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "tilemap_bind.h"
+#include "display_bind.h"
+#include "display.h"
+#include "lua_util.h"
+#include "macro.h"
+#include "util.h"
+
+Tilemap *tilemap_check(lua_State *L, int index)
+{
+	assert(L);
+
+	Tilemap **p = (Tilemap **) luaL_checkudata(L, index, "tilemap");
+	return *p;
+}
+
+static uint16_t check_tile(lua_State *L, int index, const Tilemap *tilemap, const char *name)
+{
+	lua_Integer tile = luaL_checkinteger(L, index);
+	if (tile < 0 || tile > (lua_Integer) tilemap->num_tiles)
+		luaL_error(L, "%s: the tile must be between 0 and %d", name, tilemap->num_tiles);
+	return tile;
+}
+
+/**
+ * new_tilemap(tileset, tile_w, tile_h, w, h)
+ * The tileset is kept alive by the tilemap.
+ */
+int mlua_new_tilemap(lua_State *L)
+{
+	assert(L);
+
+	Surface *tileset = pop_surface(L, 1);
+	lua_Integer tile_w = luaL_checkinteger(L, 2);
+	lua_Integer tile_h = luaL_checkinteger(L, 3);
+	lua_Integer w = luaL_checkinteger(L, 4);
+	lua_Integer h = luaL_checkinteger(L, 5);
+	assert_lua_error(L, !tileset->grid, "new_tilemap: the tileset cannot be split in several textures");
+	assert_lua_error(L, tile_w >= 1 && tile_w <= (lua_Integer) tileset->w, "new_tilemap: tile_w must be between 1 and the width of the tileset");
+	assert_lua_error(L, tile_h >= 1 && tile_h <= (lua_Integer) tileset->h, "new_tilemap: tile_h must be between 1 and the height of the tileset");
+	assert_lua_error(L, w >= 1 && w <= 65536, "new_tilemap: w must be between 1 and 65536");
+	assert_lua_error(L, h >= 1 && h <= 65536, "new_tilemap: h must be between 1 and 65536");
+
+	Tilemap **p = (Tilemap **) lua_newuserdata(L, sizeof(Tilemap *));
+	*p = tilemap_new(tileset, tile_w, tile_h, w, h);
+	luaL_setmetatable(L, "tilemap");
+	lua_pushvalue(L, 1);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+
+int mlua_tilemap_class_index(lua_State *L)
+{
+	assert(L);
+
+	Tilemap *tilemap = tilemap_check(L, 1);
+	const char* index = luaL_checkstring(L, 2);
+	if (streq(index, "w")) {
+		lua_pushinteger(L, tilemap->w);
+	} else if (streq(index, "h")) {
+		lua_pushinteger(L, tilemap->h);
+	} else if (streq(index, "tile_w")) {
+		lua_pushinteger(L, tilemap->tile_w);
+	} else if (streq(index, "tile_h")) {
+		lua_pushinteger(L, tilemap->tile_h);
+	} else if (streq(index, "tileset")) {
+		lua_getuservalue(L, 1);
+	} else {
+		lua_getmetatable(L, 1);
+		lua_getfield(L, -1, index);
+	}
+	return 1;
+}
+
+int mlua_get_tilemap(lua_State *L)
+{
+	assert(L);
+
+	Tilemap *tilemap = tilemap_check(L, 1);
+	lua_Integer x = luaL_checkinteger(L, 2);
+	lua_Integer y = luaL_checkinteger(L, 3);
+	assert_lua_error(L, x >= 1 && (unsigned int) x <= tilemap->w, "get: x is out of bounds");
+	assert_lua_error(L, y >= 1 && (unsigned int) y <= tilemap->h, "get: y is out of bounds");
+
+	lua_pushinteger(L, tilemap_get(tilemap, x - 1, y - 1));
+	return 1;
+}
+
+int mlua_set_tilemap(lua_State *L)
+{
+	assert(L);
+
+	Tilemap *tilemap = tilemap_check(L, 1);
+	lua_Integer x = luaL_checkinteger(L, 2);
+	lua_Integer y = luaL_checkinteger(L, 3);
+	uint16_t tile = check_tile(L, 4, tilemap, "set");
+	assert_lua_error(L, x >= 1 && (unsigned int) x <= tilemap->w, "set: x is out of bounds");
+	assert_lua_error(L, y >= 1 && (unsigned int) y <= tilemap->h, "set: y is out of bounds");
+
+	tilemap_set(tilemap, x - 1, y - 1, tile);
+	return 0;
+}
+
+/**
+ * fill(x, y, w, h, tile)
+ * The rectangle is clipped to the tilemap.
+ */
+int mlua_fill_tilemap(lua_State *L)
+{
+	assert(L);
+
+	Tilemap *tilemap = tilemap_check(L, 1);
+	lua_Integer x = luaL_checkinteger(L, 2) - 1;
+	lua_Integer y = luaL_checkinteger(L, 3) - 1;
+	lua_Integer x0 = MAX(x, 0);
+	lua_Integer y0 = MAX(y, 0);
+	lua_Integer x1 = MIN(x + luaL_checkinteger(L, 4), (lua_Integer) tilemap->w);
+	lua_Integer y1 = MIN(y + luaL_checkinteger(L, 5), (lua_Integer) tilemap->h);
+	uint16_t tile = check_tile(L, 6, tilemap, "fill");
+	if (x0 >= x1 || y0 >= y1)
+		return 0;
+
+	tilemap_fill(tilemap, x0, y0, x1 - x0, y1 - y0, tile);
+	return 0;
+}
+
+int mlua_draw_tilemap(lua_State *L)
+{
+	assert(L);
+
+	Tilemap *tilemap = tilemap_check(L, 1);
+	lua_Number x = luaL_optnumber(L, 2, 0);
+	lua_Number y = luaL_optnumber(L, 3, 0);
+	assert_lua_error(L, display_get_draw_on(), "draw: no surface to draw on");
+
+	display_draw_tilemap(tilemap, x, y);
+	return 0;
+}
+
+int mlua_free_tilemap(lua_State *L)
+{
+	assert(L);
+
+	Tilemap **p = (Tilemap **) luaL_checkudata(L, 1, "tilemap");
+	tilemap_free(*p);
+	*p = NULL;
+	return 0;
+}
@@ -0,0 +1,31 @@
+/**
+ * This file is part of Drystal.
+ *
+ * Drystal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Drystal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Drystal.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <lua.h>
+
+#include "tilemap.h"
+
+Tilemap *tilemap_check(lua_State *L, int index);
+
+int mlua_new_tilemap(lua_State *L);
+int mlua_tilemap_class_index(lua_State *L);
+int mlua_get_tilemap(lua_State *L);
+int mlua_set_tilemap(lua_State *L);
+int mlua_fill_tilemap(lua_State *L);
+int mlua_draw_tilemap(lua_State *L);
+int mlua_free_tilemap(lua_State *L);
@@ -105,7 +105,7 @@ int main(int argc, char* argv[])
 		filename = newfilename;
 	}
 
-	r = engine_init(filename, 60);
+	r = engine_init(filename, 60, false);
 	if (r < 0) {
 		return EXIT_FAILURE;
 	}
@@ -87,6 +87,7 @@ static void help(void)
 	       "OPTIONS\n"
 	       "    -h --help       Show this help message and exit\n"
 	       "    -v --version    Show Drystal version and available features\n"
+	       "    --headless      Render offscreen, without window (useful for benchmarks and tests)\n"
 #ifdef BUILD_LIVECODING
 	       "    -l --livecoding Enable the livecoding which will reload the lua code when modifications on the files are performed\n"
 #endif
@@ -107,6 +108,7 @@ int main(int argc, char* argv[])
 #ifdef BUILD_LIVECODING
 	bool livecoding = false;
 #endif
+	bool headless = false;
 	bool is_arg[argc];
 
 	for (int i = 1; i < argc; i++) {
@@ -124,6 +126,8 @@ int main(int argc, char* argv[])
 			fprintf(stderr, "Cannot start livecoding: disabled at compilation time.\n");
 			return EXIT_FAILURE;
 #endif
+		} else if (streq(argv[i], "--headless")) {
+			headless = true;
 		} else if (!filename) {
 			filename = xstrdup(argv[i]);
 		} else {
@@ -144,7 +148,7 @@ int main(int argc, char* argv[])
 		filename = newfilename;
 	}
 
-	r = engine_init(filename, 60);
+	r = engine_init(filename, 60, headless);
 	if (r < 0) {
 		return EXIT_FAILURE;
 	}
@@ -0,0 +1,62 @@
+local drystal = require 'drystal'
+
+local big
+local x, y = 0, 0
+local angle = 0
+local zoom = 1
+
+function drystal.init()
+	drystal.resize(800, 600)
+	big = assert(drystal.load_surface('big.png'))
+	assert(big.w == 3000, 'width is not 3000, ' .. big.w)
+	assert(big.h == 2200, 'height is not 2200, ' .. big.h)
+
+	-- pixels are read from the cell which contains them
+	local r, g, b = big:get_pixel(2049 + 50, 2)
+	assert(r == 30 and g == 100 and b == 30, 'wrong pixel in the second cell')
+	local pixels = big:get_pixels(2000, 2000, 100, 100)
+	r, g, b = pixels:get(1, 1)
+	assert(r == 100 and g == 30 and b == 30, 'wrong pixel in the first cell')
+	r, g, b = pixels:get(100, 100)
+	assert(r == 100 and g == 100 and b == 30, 'wrong pixel in the last cell')
+
+	assert(not pcall(big.draw_on, big), 'a grid surface cannot be drawn on')
+end
+
+function drystal.update(dt)
+	angle = angle + dt * 0.2
+end
+
+function drystal.draw()
+	drystal.set_color(0, 0, 0)
+	drystal.draw_background()
+
+	drystal.set_color(255, 255, 255)
+	big:draw_from()
+	drystal.camera.x = x
+	drystal.camera.y = y
+	drystal.camera.zoom = zoom
+	drystal.draw_sprite_rotated({x=0, y=0, w=big.w, h=big.h}, 0, 0, angle)
+	drystal.camera.reset()
+
+	local stats = drystal.get_render_stats()
+	drystal.set_title(('culled: %d texture binds: %d'):format(stats.culled, stats.texture_binds))
+end
+
+function drystal.key_press(k)
+	if k == 'a' then
+		drystal.stop()
+	elseif k == 'left' then
+		x = x + 100
+	elseif k == 'right' then
+		x = x - 100
+	elseif k == 'up' then
+		y = y + 100
+	elseif k == 'down' then
+		y = y - 100
+	elseif k == '+' or k == 'kp+' then
+		zoom = zoom * 1.25
+	elseif k == '-' or k == 'kp-' then
+		zoom = zoom / 1.25
+	end
+end
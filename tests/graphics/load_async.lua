@@ -0,0 +1,56 @@
+local drystal = require 'drystal'
+
+local surfaces = {}
+local time = 0
+local loader
+
+function drystal.init()
+	drystal.resize(600, 400)
+
+	loader = coroutine.create(function()
+		for _, filename in ipairs {'image.png', 'npot.png', 'spritesheet.png', 'tex.png'} do
+			drystal.load_surface_async(filename, function(surface, err)
+				assert(coroutine.resume(loader, surface, err))
+			end)
+			local surface = assert(coroutine.yield())
+			print('loaded', filename, surface.w, surface.h, 'after', time)
+			table.insert(surfaces, surface)
+		end
+
+		local surface, err = (function()
+			drystal.load_surface_async('does_not_exist.png', function(...)
+				assert(coroutine.resume(loader, ...))
+			end)
+			return coroutine.yield()
+		end)()
+		assert(not surface)
+		print(err)
+	end)
+	assert(coroutine.resume(loader))
+end
+
+function drystal.update(dt)
+	time = time + dt
+end
+
+function drystal.draw()
+	drystal.set_color 'black'
+	drystal.draw_background()
+
+	-- keeps moving while the images are loading
+	drystal.set_color 'white'
+	drystal.draw_rect(300 + math.cos(time * 5) * 100, 300, 20, 20)
+
+	local x = 0
+	for _, surface in ipairs(surfaces) do
+		surface:draw_from()
+		drystal.draw_image(0, 0, surface.w, surface.h, x, 0, 150, 150)
+		x = x + 150
+	end
+end
+
+function drystal.key_press(k)
+	if k == 'a' then
+		drystal.stop()
+	end
+end
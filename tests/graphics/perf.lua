@@ -5,13 +5,24 @@ local target = 1 / 60
 local number = 300
 
 local draw_triangle = {name='draw_triangle'}
+local draw_rect = {name='draw_rect'}
+local buffer_sprites = {name='buffer_sprites'}
 local draw_sprite_simple = {name='draw_sprite_simple'}
 local draw_sprite_rotated = {name='draw_sprite_rotated'}
 local draw_sprite_resized = {name='draw_sprite_resized'}
+local draw_sprites = {name='draw_sprites'}
+local draw_sprite_transform = {name='draw_sprite_transform'}
+local draw_sprite_transform_lua = {name='draw_sprite_transform_lua'}
 local draw_font_nocolor = {name='draw_font_nocolor'}
 local draw_font_color = {name='draw_font_color'}
+local draw_circle = {name='draw_circle'}
+local draw_polyline = {name='draw_polyline'}
+local interleaved_sheets = {name='interleaved_sheets'}
+local interleaved_sheets_deferred = {name='interleaved_sheets_deferred'}
 local state = {}
-local states = { draw_triangle, draw_sprite_simple, draw_sprite_rotated, draw_sprite_resized, draw_font_nocolor, draw_font_color }
+local states = { draw_triangle, draw_rect, draw_circle, draw_polyline, buffer_sprites, draw_sprite_simple, draw_sprite_rotated, draw_sprite_resized, draw_sprites, draw_sprite_transform, draw_sprite_transform_lua,
+                 draw_font_nocolor, draw_font_color,
+                 interleaved_sheets, interleaved_sheets_deferred }
 local current_state = 1
 local number = 0
 local tick = 0
@@ -20,10 +31,18 @@ local sprite = {x=0, y=0, w=22, h=33}
 local spritesheet = nil
 local font = nil
 local font_big = nil
+-- label printed with the results, so runs of different builds can be compared
+-- e.g. 'drystal perf.lua separate' and 'drystal perf.lua interleaved'
+local label = arg and arg[1] or ''
 
 function set_state(s)
+	if state.leave then
+		state:leave()
+	end
 	state = s
 	s.max = 0
+	s.frames = 0
+	s.time = 0
 	if state.init then
 		state:init()
 	end
@@ -46,6 +65,64 @@ function draw_triangle:draw()
 	end
 end
 
+function draw_circle:draw()
+	drystal.set_color(0, 0, 0)
+	drystal.draw_background()
+
+	drystal.set_alpha(255)
+	drystal.set_color(0, 200, 0)
+	for i = 1, number do
+		drystal.draw_circle(random(W), random(H), random(30))
+	end
+end
+
+function draw_polyline:draw()
+	drystal.set_color(0, 0, 0)
+	drystal.draw_background()
+
+	drystal.set_alpha(255)
+	drystal.set_color(0, 0, 200)
+	for i = 1, number do
+		local x = random(W)
+		local y = random(H)
+		drystal.draw_polyline(true, 2, x, y, x+random(20), y, x+random(20), y+random(20), x, y+random(20))
+	end
+end
+
+function draw_rect:draw()
+	drystal.set_color(0, 0, 0)
+	drystal.draw_background()
+
+	drystal.set_alpha(200)
+	for i = 1, number do
+		local x = random(W)
+		local y = random(H)
+		drystal.set_color(random(255), random(255), random(255))
+		drystal.draw_rect(x, y, random(20), random(20))
+	end
+end
+
+-- fill a user buffer every frame: stresses the vertex layout (push and upload)
+function buffer_sprites:init()
+	self.buffer = drystal.new_buffer()
+end
+
+function buffer_sprites:draw()
+	drystal.set_color(255, 255, 255)
+	drystal.set_alpha(255)
+	drystal.draw_background()
+
+	self.buffer:reset()
+	self.buffer:use()
+	for i = 1, number do
+		local x = random(W)
+		local y = random(H)
+		drystal.draw_sprite(sprite, x, y)
+	end
+	drystal.use_default_buffer()
+	self.buffer:draw()
+end
+
 function draw_sprite_simple:draw()
 	drystal.set_color(255, 255, 255)
 	drystal.set_alpha(255)
@@ -85,6 +162,130 @@ function draw_sprite_resized:draw()
 	end
 end
 
+-- alternate between two spritesheets: one flush per sprite, unless deferred
+function interleaved_sheets:init()
+	self.other = drystal.new_surface(64, 64)
+	self.other:draw_on()
+	drystal.set_color(0, 255, 0)
+	drystal.draw_background()
+	drystal.screen:draw_on()
+end
+
+function interleaved_sheets:draw()
+	drystal.set_color(255, 255, 255)
+	drystal.set_alpha(255)
+	drystal.draw_background()
+
+	for i = 1, number do
+		local x = random(W)
+		local y = random(H)
+		if i % 2 == 0 then
+			spritesheet:draw_from()
+		else
+			self.other:draw_from()
+		end
+		drystal.draw_sprite(sprite, x, y)
+	end
+	spritesheet:draw_from()
+end
+
+function interleaved_sheets_deferred:init()
+	interleaved_sheets.init(self)
+	drystal.set_deferred(true)
+end
+
+interleaved_sheets_deferred.draw = interleaved_sheets.draw
+
+function interleaved_sheets_deferred:leave()
+	drystal.set_deferred(false)
+end
+
+function draw_sprites:draw()
+	drystal.set_color(255, 255, 255)
+	drystal.set_alpha(255)
+	drystal.draw_background()
+
+	if not self.array or #self.array ~= number * 5 then
+		self.array = drystal.new_float_array(number * 5)
+	end
+	local array = self.array
+	for i = 0, number - 1 do
+		array[i * 5 + 1] = random(W)
+		array[i * 5 + 2] = random(H)
+		array[i * 5 + 3] = random() * math.pi
+		array[i * 5 + 4] = 1
+		array[i * 5 + 5] = 0xffffff
+	end
+	drystal.draw_sprites(sprite, array)
+end
+
+local transform = {angle=0, wfactor=-1, hfactor=1.5}
+
+function draw_sprite_transform:draw()
+	drystal.set_color(255, 255, 255)
+	drystal.set_alpha(255)
+	drystal.draw_background()
+
+	for i = 1, number do
+		local x = random(W)
+		local y = random(H)
+		transform.angle = random() * math.pi
+		drystal.draw_sprite(sprite, x, y, transform)
+	end
+end
+
+-- the previous Lua implementation of draw_sprite, to compare with the C one
+local function lua_draw_sprite(sprite, x, y, transform, hx, hy)
+	local w = sprite.w * math.abs(transform.wfactor)
+	local h = sprite.h * math.abs(transform.hfactor)
+	if not hx then hx = w / 2 end
+	if not hy then hy = h / 2 end
+	local centerx, centery = x + hx, y + hy
+	local angle = transform.angle
+	local cos = math.cos(angle)
+	local sin = math.sin(angle)
+	local function rotate(_x, _y)
+		return _x * cos - _y * sin,
+			   _x * sin + _y * cos
+	end
+	local function translate(_x, _y)
+		return centerx + _x, centery + _y
+	end
+
+	local x1, y1 = translate(rotate(x - centerx, y - centery))
+	local x2, y2 = translate(rotate(x + w - centerx, y - centery))
+	local x3, y3 = translate(rotate(x + w - centerx, y + h - centery))
+	local x4, y4 = translate(rotate(x - centerx, y + h - centery))
+
+	local xi = sprite.x
+	local yi = sprite.y
+	local xi2 = sprite.x + sprite.w
+	local yi2 = sprite.y + sprite.h
+
+	if transform.wfactor < 0 then
+		xi, xi2 = xi2, xi
+	end
+	if transform.hfactor < 0 then
+		yi, yi2 = yi2, yi
+	end
+
+	drystal.draw_quad(xi, yi, xi2, yi, xi2, yi2, xi, yi2,
+	                  x1, y1, x2,  y2, x3,  y3,  x4, y4)
+end
+
+function draw_sprite_transform_lua:draw()
+	drystal.set_color(255, 255, 255)
+	drystal.set_alpha(255)
+	drystal.draw_background()
+
+	for i = 1, number do
+		local x = random(W)
+		local y = random(H)
+		transform.angle = random() * math.pi
+		lua_draw_sprite(sprite, x, y, transform)
+	end
+end
+
 function highlight(text, pos)
 	return text:sub(0, pos-1) .. '{big|'.. text:sub(pos, pos) .. '}' .. text:sub(pos+1, #text)
 end
@@ -130,12 +331,14 @@ function drystal.init()
 	spritesheet:draw_from()
 	set_state(states[current_state])
 
-	print('name                max')
+	print('name                max        ' .. label)
 end
 
 function drystal.update(dt)
 	if tick > 100 then
 		state.max = math.max(state.max, number)
+		state.frames = state.frames + 1
+		state.time = state.time + dt
 		if dt > target * 1.2 then
 			number = number - 5
 		else
@@ -145,7 +348,19 @@ function drystal.update(dt)
 	tick = tick + 1
 	if tick > 600 and dt - target <= 1 then
 		collectgarbage()
-		print(state.name .. '        ' .. state.max)
+		local stats = drystal.get_render_stats()
+		print(state.name .. '        ' .. state.max .. '        ' .. label)
+		print(('    frame time: %.2fms'):format(state.time / state.frames * 1000))
+		print('    flushes: ' .. stats.flushes .. ' uploaded: ' .. stats.bytes_uploaded / 1024 .. 'KB'
+		      .. ' draw calls: ' .. stats.draw_calls .. ' texture binds: ' .. stats.texture_binds)
+		local causes = {}
+		for cause, n in pairs(stats.flush_causes) do
+			if n > 0 then
+				table.insert(causes, cause .. ': ' .. n)
+			end
+		end
+		table.sort(causes)
+		print('    flush causes: ' .. table.concat(causes, ' '))
 		current_state = current_state + 1
 		if states[current_state] then
 			tick = 0
@@ -69,7 +69,9 @@ end
 
 function drystal.mouse_motion(x, y)
 	mx, my = x, y
-	shader:feed('mx', (mx/width) * 2 - 1)
-	shader:feed('my', (1-my/height) * 2 - 1)
+	shader:feed_many{
+		mx=(mx/width) * 2 - 1,
+		my=(1-my/height) * 2 - 1,
+	}
 end
 
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# coding: utf-8
+#
+# Pre-bakes the PNG images of a game into a drystal texture cache, so that
+# the game does not decode them at startup (see drystal.set_texture_cache).
+#
+# The images are decoded by drystal itself (in headless mode), so the cache
+# contains exactly what the game would have produced on its first run.
+
+import os
+import sys
+import shutil
+import tempfile
+import subprocess
+
+G, I, W, E, N = '', '', '', '', ''
+if sys.stdout.isatty():
+    G = '\033[92m'
+    I = '\033[95m'
+    W = '\033[93m'
+    E = '\033[91m'
+    N = '\033[m'
+
+CACHE_EXTENSION = '.tex'
+
+BAKE_SCRIPT = """
+local drystal = require 'drystal'
+
+local files = {
+%s
+}
+
+function drystal.init()
+	drystal.set_texture_cache(%s)
+	for _, filename in ipairs(files) do
+		local surface, err = drystal.load_surface(filename)
+		if surface then
+			print('+', filename)
+		else
+			print('!', err)
+		end
+		-- do not keep every texture alive
+		surface = nil
+		collectgarbage()
+	end
+	drystal.stop()
+end
+"""
+
+
+def lua_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def cache_name(path):
+    # same FNV-1a as src/graphics/texture_cache.c
+    h = 14695981039346656037
+    for c in path.encode('utf-8'):
+        h ^= c
+        h = (h * 1099511628211) & 0xffffffffffffffff
+    return '%016x%s' % (h, CACHE_EXTENSION)
+
+
+def collect_images(directory, cache):
+    images = []
+    for root, dirs, files in os.walk(directory):
+        dirs[:] = [d for d in dirs if not d.startswith('.')
+                   and os.path.abspath(os.path.join(root, d)) != cache]
+        for f in files:
+            if f.lower().endswith('.png'):
+                images.append(os.path.relpath(os.path.join(root, f), directory))
+    return sorted(images)
+
+
+def prune(cache, images):
+    expected = set(cache_name(i) for i in images)
+    for f in os.listdir(cache):
+        if f.endswith(CACHE_EXTENSION) and f not in expected:
+            print(W, '\t- ', f + N)
+            os.remove(os.path.join(cache, f))
+
+
+def bake(args):
+    directory = os.path.abspath(args.directory)
+    cache = os.path.abspath(os.path.join(directory, args.cache))
+
+    images = collect_images(directory, cache)
+    if not images:
+        print(W, '- no image found in', directory + N)
+        return 0
+    print(G, '- baking', len(images), 'images into', cache + N)
+
+    script_dir = tempfile.mkdtemp(prefix='drystal-texcache-')
+    try:
+        script = os.path.join(script_dir, 'main.lua')
+        with open(script, 'w') as f:
+            f.write(BAKE_SCRIPT % (',\n'.join('\t' + lua_string(i) for i in images),
+                                   lua_string(os.path.relpath(cache, directory))))
+        cmd = [args.drystal, '--headless', script]
+        print(I + ' '.join(cmd) + N)
+        r = subprocess.call(cmd, cwd=directory)
+    finally:
+        shutil.rmtree(script_dir)
+
+    if r != 0:
+        print(E + 'drystal failed with status', str(r) + N)
+        return r
+
+    if args.prune:
+        prune(cache, images)
+    return 0
+
+
+if __name__ == '__main__':
+    import argparse
+    parser = argparse.ArgumentParser(description='Pre-bake the PNG images of a game into a texture cache.')
+    parser.add_argument('directory', nargs='?', default='.',
+                        help='directory of the game, image paths are relative to it (default: .)')
+    parser.add_argument('--cache', default='.texcache',
+                        help='cache directory, relative to the game directory (default: .texcache)')
+    parser.add_argument('--drystal', default='drystal',
+                        help='drystal executable used to decode the images')
+    parser.add_argument('--prune', action='store_true',
+                        help='remove the cache entries of images which do not exist anymore')
+    sys.exit(bake(parser.parse_args()))